@@ -0,0 +1,58 @@
+#include "Cache.h"
+#include "MemDebug.h"
+#include <stdio.h>
+#include <unistd.h>
+
+/* Write the path of the cache entry for the given game into `path'. */
+static void entry_path(char *path, const char *dir, Game *game)
+{
+    sprintf(path, "%.900s/%016llx.txt", dir, game_hash(game));
+}
+
+Board *cache_load(const char *dir, Game *game)
+{
+    char path[1024];
+    FILE *fp;
+    Board *board;
+
+    entry_path(path, dir, game);
+    if ((fp = fopen(path, "rt")) == NULL) return NULL;
+    board = board_clone(game->initial);
+    if (board != NULL && moves_replay(board, fp) < 0)
+    {
+        /* Corrupt entry; ignore it */
+        board_free(board);
+        board = NULL;
+    }
+    fclose(fp);
+
+    return board;
+}
+
+int cache_store(const char *dir, Game *game, Move *last_move, int score)
+{
+    char path[1024], tmp_path[1024 + 32];
+    Board *old;
+    FILE *fp;
+
+    /* Don't replace entries which are at least as good */
+    old = cache_load(dir, game);
+    if (old != NULL)
+    {
+        int old_score = old->score;
+        board_free(old);
+        if (old_score >= score) return 0;
+    }
+
+    entry_path(path, dir, game);
+    sprintf(tmp_path, "%s.%d.tmp", path, (int)getpid());
+    if ((fp = fopen(tmp_path, "wt")) == NULL) return 0;
+    moves_print(last_move, fp);
+    if (fclose(fp) != 0 || rename(tmp_path, path) != 0)
+    {
+        remove(tmp_path);
+        return 0;
+    }
+
+    return 1;
+}
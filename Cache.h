@@ -0,0 +1,26 @@
+#ifndef CACHE_H_INCLUDED
+#define CACHE_H_INCLUDED
+
+/* On-disk cache of the best known move trace for each game.
+
+   Entries are stored in a cache directory as text files in the same format
+   as the player's output, named after the hash of the game definition (see
+   game_hash()), so the same case is recognized regardless of where it is
+   loaded from.
+*/
+
+#include "Game.h"
+
+/* Load the cached trace for the given game and return a board with all moves
+   executed (including trace information), or NULL if the cache contains no
+   valid entry for this game. The board must be freed with board_free(). */
+Board *cache_load(const char *dir, Game *game);
+
+/* Store the trace ending in `last_move' in the cache, unless the cache
+   already contains an entry with a score of at least `score'. The entry is
+   written to a temporary file first and then renamed, so concurrent readers
+   never see a partially written entry.
+   Returns non-zero if the entry was stored. */
+int cache_store(const char *dir, Game *game, Move *last_move, int score);
+
+#endif /* ndef CACHE_H_INCLUDED */
@@ -0,0 +1,453 @@
+#define _GNU_SOURCE     /* MSG_NOSIGNAL, MSG_DONTWAIT */
+#include "Exchange.h"
+#include "MemDebug.h"
+#include "Util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define EXCHANGE_MAGIC  (0x58454a42UL)  /* "BJEX" */
+#define HEADER_SIZE     (20)            /* magic, hash, score, count */
+#define MAX_CLIENTS     (64)
+#define POLL_TIMEOUT    (100)           /* milliseconds */
+
+/* Coordinator's state of a connected worker */
+typedef struct Client
+{
+    int             fd;
+    unsigned char   *in;            /* partially received messages */
+    size_t          in_size, in_capacity;
+    unsigned char   *out;           /* data not yet sent */
+    size_t          out_pos, out_size, out_capacity;
+} Client;
+
+/* Append data to a growable buffer. Returns zero if allocation fails. */
+static int buffer_append( unsigned char **buf, size_t *size, size_t *capacity,
+                          const void *data, size_t len )
+{
+    if (*size + len > *capacity)
+    {
+        size_t new_capacity = *capacity ? *capacity : 4096;
+        unsigned char *new_buf;
+        while (new_capacity < *size + len) new_capacity *= 2;
+        new_buf = realloc(*buf, new_capacity);
+        if (new_buf == NULL) return 0;
+        *buf = new_buf;
+        *capacity = new_capacity;
+    }
+    memcpy(*buf + *size, data, len);
+    *size += len;
+    return 1;
+}
+
+/* Read all data available on a socket into a buffer, without blocking.
+   Returns zero if the connection was closed or an error occurred. */
+static int buffer_receive( int fd, unsigned char **buf, size_t *size,
+                           size_t *capacity )
+{
+    unsigned char data[65536];
+    ssize_t len;
+
+    for (;;)
+    {
+        len = recv(fd, data, sizeof(data), MSG_DONTWAIT);
+        if (len > 0)
+        {
+            if (!buffer_append(buf, size, capacity, data, len)) return 0;
+        }
+        else
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return 1;
+        }
+        else
+        if (len < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+}
+
+/* Encode a solution as a message. Returns NULL if allocation fails. */
+static unsigned char *encode_solution( unsigned long long hash, int score,
+                                       Move *last_move, size_t *len )
+{
+    unsigned char *buf, *p;
+    size_t count = 0;
+    Move *move;
+
+    for (move = last_move; move != NULL; move = move->prev) ++count;
+    *len = HEADER_SIZE + 4*count;
+    if ((buf = malloc(*len)) == NULL) return NULL;
+    util_put_u32(buf +  0, EXCHANGE_MAGIC);
+    util_put_u32(buf +  4, (unsigned long)(hash >>  0));
+    util_put_u32(buf +  8, (unsigned long)(hash >> 32));
+    util_put_u32(buf + 12, (unsigned long)score);
+    util_put_u32(buf + 16, (unsigned long)count);
+    p = buf + *len;
+    for (move = last_move; move != NULL; move = move->prev)
+    {
+        p -= 4;
+        p[0] = move->r1;
+        p[1] = move->c1;
+        p[2] = move->r2;
+        p[3] = move->c2;
+    }
+
+    return buf;
+}
+
+/* Replay a list of moves (in message format) on the initial board with
+   trace information. Returns NULL if any move is invalid, or if memory
+   allocation fails. */
+static Board *replay_moves( Game *game, const unsigned char *moves,
+                            size_t count )
+{
+    Board *board;
+    size_t n;
+
+    board = board_clone(game->initial);
+    if (board == NULL) return NULL;
+    for (n = 0; n < count; ++n, moves += 4)
+    {
+        int r1 = moves[0], c1 = moves[1], r2 = moves[2], c2 = moves[3];
+        if ( r1 >= game->height || c1 >= game->width ||
+             r2 >= game->height || c2 >= game->width ||
+             (r1 - r2)*(r1 - r2) + (c1 - c2)*(c1 - c2) != 1 ||
+             FLD(board, r1, c1) <= 0 || FLD(board, r2, c2) <= 0 ||
+             board_move(board, r1, c1, r2, c2, 1) == 0 )
+        {
+            board_free(board);
+            return NULL;
+        }
+    }
+
+    return board;
+}
+
+/* Parse the first message in a buffer. Returns -1 if the buffer does not
+   start with a valid message header, 0 if the message is incomplete, or the
+   length of the message otherwise. In the last case, *board is set to the
+   board at the end of the solution, or NULL if the solution is invalid. */
+static long parse_message( const unsigned char *buf, size_t size,
+                           unsigned long long hash, Game *game,
+                           Board **board )
+{
+    unsigned long count;
+    size_t len;
+
+    if (size < HEADER_SIZE) return 0;
+    count = util_get_u32(buf + 16);
+    if (util_get_u32(buf) != EXCHANGE_MAGIC || count > MOVE_LIMIT) return -1;
+    len = HEADER_SIZE + 4*count;
+    if (size < len) return 0;
+
+    *board = NULL;
+    if ( util_get_u32(buf + 4) == (unsigned long)(hash & 0xffffffffUL) &&
+         util_get_u32(buf + 8) == (unsigned long)(hash >> 32) )
+    {
+        *board = replay_moves(game, buf + HEADER_SIZE, count);
+        if ( *board != NULL &&
+             (unsigned long)(*board)->score != util_get_u32(buf + 12) )
+        {
+            board_free(*board);
+            *board = NULL;
+        }
+    }
+
+    return (long)len;
+}
+
+/* Send all data, blocking if necessary. Returns zero on failure. */
+static int send_all(int fd, const unsigned char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return 0;
+        data += sent;
+        len -= sent;
+    }
+    return 1;
+}
+
+Exchange *exchange_connect(const char *path, Game *game)
+{
+    Exchange *ex;
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    ex = malloc(sizeof(Exchange));
+    if (ex == NULL) return NULL;
+    memset(ex, 0, sizeof(Exchange));
+    ex->game = game;
+    ex->hash = game_hash(game);
+    ex->fd   = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ex->fd < 0) goto failed;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(ex->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        goto failed;
+    }
+    return ex;
+
+failed:
+    if (ex->fd >= 0) close(ex->fd);
+    free(ex);
+    return NULL;
+}
+
+void exchange_close(Exchange *ex)
+{
+    if (ex != NULL)
+    {
+        close(ex->fd);
+        free(ex->buf);
+        free(ex);
+    }
+}
+
+int exchange_send(Exchange *ex, int score, Move *last_move)
+{
+    unsigned char *msg;
+    size_t len;
+    int res;
+
+    if (score <= ex->best_score) return 1;
+    msg = encode_solution(ex->hash, score, last_move, &len);
+    if (msg == NULL) return 0;
+    res = send_all(ex->fd, msg, len);
+    free(msg);
+    if (res) ex->best_score = score;
+    return res;
+}
+
+Board *exchange_receive(Exchange *ex)
+{
+    Board *best = NULL, *board;
+    long len;
+
+    buffer_receive(ex->fd, &ex->buf, &ex->size, &ex->capacity);
+    while ( (len = parse_message( ex->buf, ex->size, ex->hash,
+                                  ex->game, &board )) != 0 )
+    {
+        if (len < 0)
+        {
+            /* Corrupt data: discard everything received */
+            ex->size = 0;
+            break;
+        }
+        memmove(ex->buf, ex->buf + len, ex->size - len);
+        ex->size -= len;
+        if (board != NULL && board->score > ex->best_score)
+        {
+            ex->best_score = board->score;
+            board_free(best);
+            best = board;
+        }
+        else
+        {
+            board_free(board);
+        }
+    }
+
+    return best;
+}
+
+/* Queue data to be sent to a client. Returns zero if allocation fails. */
+static int client_queue(Client *client, const unsigned char *data, size_t len)
+{
+    if (client->out_pos > 0)
+    {
+        memmove( client->out, client->out + client->out_pos,
+                 client->out_size - client->out_pos );
+        client->out_size -= client->out_pos;
+        client->out_pos = 0;
+    }
+    return buffer_append( &client->out, &client->out_size,
+                          &client->out_capacity, data, len );
+}
+
+static void client_close(Client *client)
+{
+    close(client->fd);
+    free(client->in);
+    free(client->out);
+}
+
+Board *exchange_serve(const char *path, Game *game, long long max_usec)
+{
+    long long time_start = util_ustime();
+    unsigned long long hash = game_hash(game);
+    struct sockaddr_un addr;
+    struct pollfd fds[MAX_CLIENTS + 1];
+    Client clients[MAX_CLIENTS];
+    int num_clients = 0, connected = 0, listen_fd, n, i;
+    unsigned char *best_msg = NULL;
+    size_t best_len = 0;
+    Board *best = NULL;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return NULL;
+    }
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+    {
+        perror("socket");
+        return NULL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if ( bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+         listen(listen_fd, MAX_CLIENTS) != 0 )
+    {
+        perror(path);
+        close(listen_fd);
+        return NULL;
+    }
+    fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+
+    while (util_ustime() - time_start < max_usec)
+    {
+        if (connected > 0 && num_clients == 0) break;
+
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (n = 0; n < num_clients; ++n)
+        {
+            fds[n + 1].fd = clients[n].fd;
+            fds[n + 1].events = POLLIN;
+            if (clients[n].out_pos < clients[n].out_size)
+            {
+                fds[n + 1].events |= POLLOUT;
+            }
+        }
+        if (poll(fds, num_clients + 1, POLL_TIMEOUT) <= 0) continue;
+
+        /* Send pending data and receive new solutions */
+        for (n = 0; n < num_clients; ++n)
+        {
+            Client *client = &clients[n];
+            bool failed = false;
+            long len;
+
+            if (fds[n + 1].revents & POLLOUT)
+            {
+                ssize_t sent = send( client->fd,
+                    client->out + client->out_pos,
+                    client->out_size - client->out_pos,
+                    MSG_NOSIGNAL | MSG_DONTWAIT );
+                if (sent > 0) client->out_pos += sent;
+            }
+
+            if (fds[n + 1].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                failed = !buffer_receive( client->fd, &client->in,
+                                          &client->in_size,
+                                          &client->in_capacity );
+            }
+
+            while (!failed)
+            {
+                Board *board;
+
+                len = parse_message( client->in, client->in_size, hash, game,
+                                     &board );
+                if (len == 0) break;
+                if (len < 0)
+                {
+                    failed = true;
+                    break;
+                }
+                if ( board != NULL &&
+                     (best == NULL || board->score > best->score) )
+                {
+                    /* New best solution: forward it to other workers */
+                    printf( "Received solution: score=%d moves=%d\n",
+                            board->score, board->moves );
+                    board_free(best);
+                    best = board;
+                    free(best_msg);
+                    best_len = len;
+                    best_msg = malloc(best_len);
+                    if (best_msg != NULL)
+                    {
+                        memcpy(best_msg, client->in, best_len);
+                        for (i = 0; i < num_clients; ++i)
+                        {
+                            if (i != n) client_queue( &clients[i],
+                                                      best_msg, best_len );
+                        }
+                    }
+                }
+                else
+                {
+                    board_free(board);
+                }
+                memmove(client->in, client->in + len, client->in_size - len);
+                client->in_size -= len;
+            }
+
+            if (failed)
+            {
+                /* Worker disconnected (or sent invalid data) */
+                client_close(client);
+                clients[n] = clients[--num_clients];
+                fds[n + 1] = fds[num_clients + 1];
+                --n;
+            }
+        }
+
+        /* Accept new workers */
+        if (fds[0].revents & POLLIN)
+        {
+            int fd;
+            while ((fd = accept(listen_fd, NULL, NULL)) >= 0)
+            {
+                if (num_clients == MAX_CLIENTS)
+                {
+                    close(fd);
+                    continue;
+                }
+                memset(&clients[num_clients], 0, sizeof(Client));
+                clients[num_clients].fd = fd;
+                if (best_msg != NULL)
+                {
+                    client_queue(&clients[num_clients], best_msg, best_len);
+                }
+                ++num_clients;
+                ++connected;
+            }
+        }
+    }
+
+    for (n = 0; n < num_clients; ++n) client_close(&clients[n]);
+    close(listen_fd);
+    unlink(path);
+    free(best_msg);
+    printf( "Served %d workers in %.3fs\n", connected,
+            1e-6*(util_ustime() - time_start) );
+
+    return best;
+}
@@ -0,0 +1,60 @@
+#ifndef EXCHANGE_H_INCLUDED
+#define EXCHANGE_H_INCLUDED
+
+/* Exchange of solutions between several player processes searching the same
+   game, over a Unix domain socket.
+
+   One process acts as the coordinator: it accepts connections from worker
+   processes, keeps track of the best solution found by any of them, and
+   forwards each improvement to all other workers. Workers periodically send
+   their best solution when it improves, and receive better solutions found
+   elsewhere, which they can add to their own search.
+
+   A solution is sent as a message consisting of the magic number "BJEX",
+   the game hash (64 bits), the score, the number of moves and the moves
+   themselves (four bytes each: r1, c1, r2, c2); all integers are 32 bits
+   little-endian unless noted otherwise. Solutions are reconstructed by
+   replaying the moves on the initial board, so invalid solutions (or
+   solutions for a different game) are rejected.
+*/
+
+#include "Game.h"
+#include <stddef.h>
+
+/* Connection of a worker to the coordinator */
+typedef struct Exchange
+{
+    int             fd;             /* socket */
+    Game            *game;          /* game being searched */
+    unsigned long long hash;        /* hash of the game */
+    unsigned char   *buf;           /* partially received messages */
+    size_t          size, capacity; /* used and allocated size of buf */
+    int             best_score;     /* best score sent or received */
+} Exchange;
+
+/* Connect to the coordinator listening at the given socket path. Returns
+   NULL (with errno set) if the connection fails. */
+Exchange *exchange_connect(const char *path, Game *game);
+
+/* Close the connection to the coordinator. */
+void exchange_close(Exchange *ex);
+
+/* Send a solution to the coordinator, if its score is better than the best
+   score sent or received before. Returns zero if sending failed. */
+int exchange_send(Exchange *ex, int score, Move *last_move);
+
+/* Receive a solution from the coordinator without blocking. Returns the
+   board at the end of the best solution received (with trace information)
+   if it is better than the best score sent or received before, or NULL
+   otherwise. */
+Board *exchange_receive(Exchange *ex);
+
+/* Run the coordinator: listen at the given socket path, and exchange
+   solutions between workers until all workers that connected have
+   disconnected again, or until `max_usec' microseconds have passed.
+
+   Returns the board at the end of the best solution received (with trace
+   information), or NULL if no solutions were received. */
+Board *exchange_serve(const char *path, Game *game, long long max_usec);
+
+#endif /* ndef EXCHANGE_H_INCLUDED */
@@ -17,6 +17,94 @@ typedef struct Rect
     int r1, c1, r2, c2;
 } Rect;
 
+/* Header of a saved part of a column in an undo record: rows r1 through r2
+   (exclusive) of column c follow, preceded by the column's drop list position
+   if this is the first part of the column saved for the move. */
+typedef struct UndoChunk
+{
+    unsigned char c, r1, r2, first;
+} UndoChunk;
+
+/* Trailer of an undo record, following the saved column parts */
+typedef struct UndoRecord
+{
+    size_t length;                  /* length of the record (incl. trailer) */
+    Move *last_move;                /* last move before the move */
+    int score, moves;               /* score and move count before the move */
+    unsigned char r1, c1, r2, c2;   /* move coordinates */
+    unsigned char trace;            /* whether the move was traced */
+    unsigned dead_regions;          /* dead regions before the move */
+} UndoRecord;
+
+/* Maximum number of threads with their own queue of dead moves */
+#define MAX_THREADS (64)
+
+/* Maximum number of dead moves freed per call to move_deref() */
+#define RECLAIM_BATCH (32)
+
+/* Queue of moves whose reference count dropped to zero, which are freed
+   later in small batches (so that dropping a long trace does not stall the
+   thread that happens to release the last reference). Each thread has its
+   own queue, so no locking is required. */
+typedef struct DeadMoves
+{
+    Move    **moves;
+    size_t  size, capacity;
+    char    padding[64 - sizeof(Move**) - 2*sizeof(size_t)];
+} DeadMoves;
+
+static DeadMoves dead_moves[MAX_THREADS];
+
+/* Number of moves performed by a thread (padded to avoid false sharing).
+   The last counter is shared by threads beyond the first MAX_THREADS.
+   Counters are updated and read atomically, since they are read while other
+   threads update them, and 64-bit accesses need not be atomic otherwise
+   (e.g. on 32-bit x86). */
+typedef struct MoveCounter
+{
+    unsigned long long  count;
+    char                padding[64 - sizeof(unsigned long long)];
+} MoveCounter;
+
+static MoveCounter move_counters[MAX_THREADS + 1];
+
+/* Maximum number of NUMA nodes with their own pool of free boards */
+#define MAX_NODES (16)
+
+/* Maximum number of free boards kept in a pool */
+#define POOL_CAPACITY (4096)
+
+/* Simple spin lock (pool operations are short) */
+#define LOCK(lock)      while (__sync_lock_test_and_set(&(lock), 1)) { }
+#define UNLOCK(lock)    __sync_lock_release(&(lock))
+
+/* Allocate memory on behalf of the caller at the given source location */
+#ifdef MEM_DEBUG
+#define site_malloc(file, line, size)   mem_debug_malloc(file, line, size)
+#else
+#define site_malloc(file, line, size)   ((void)(file), (void)(line), \
+                                         malloc(size))
+#endif
+
+/* Pool of free boards allocated on one NUMA node (padded to avoid false
+   sharing) */
+typedef struct BoardPool
+{
+    volatile int    lock;
+    size_t          size;
+    Board           **boards;
+    char            padding[64 - sizeof(int) - sizeof(size_t) -
+                            sizeof(Board**)];
+} BoardPool;
+
+static BoardPool pools[MAX_NODES];
+static int num_pools = 0;
+static __thread int thread_node = 0;
+
+/* Number of bytes currently allocated for boards and move trace nodes.
+   Updated atomically, since boards are allocated from multiple threads. */
+static size_t board_bytes, move_bytes;
+
 static int min(int i, int j) { return i < j ? i : j; }
 static int max(int i, int j) { return i > j ? i : j; }
 
@@ -73,174 +161,111 @@ static void merge3(int *grp, int *crd, int i, int j, int k)
     }
 }
 
-/* Removes groups of blocks that form scoring rows (i.e. at least three
-   horizontally or vertically adjecent blocks)
-
-   Uses a disjoint-set data structure to identify overlapping groups. */
-static int remove_groups(Board *board, Rect *area)
+/* Save the top part of column c of the board, up to and including row r, in
+   the undo log. Rows saved earlier during the current move are skipped, so
+   every field is saved at most once per move: since fields are only changed
+   after they have been saved, and fill_columns() only changes fields above
+   removed fields, the saved values are the ones from before the move. */
+static void undo_save(UndoLog *log, const Board *board, int r, int c)
 {
-    int n, r, c, score;
-    int grp[MAX_HEIGHT*MAX_WIDTH];  /* group assignment for cells */
-    int crd[MAX_HEIGHT*MAX_WIDTH];  /* group cardinality for cells */
-    const int stride = board->game->width;
-    const int w = area->c2 - area->c1;
-    const int h = area->r2 - area->r1;
-    Field (* fields)[stride]; /* HACK: GCC extension */
-
-    fields = (Field(*)[stride])&FLD(board, area->r1, area->c1);
-
-    /* Create initial groups: each cell in its own group */
-    for (n = 0; n < w*h; ++n)
-    {
-        grp[n] = n;
-        crd[n] = 1;
-    }
+    UndoChunk chunk;
+    unsigned char *p;
 
-    score = 0;
+    if (r < log->saved[c]) return;
 
-    /* Find horizontal groups of length at least 3 */
-    for (r = h - 1; r >= 0; --r)
-    {
-        for (c = w - 3; c >= 0; --c)
-        {
-            if (fields[r][c] <= FIELD_EMPTY) continue;
-
-            if ( fields[r][c + 0] == fields[r][c + 1] &&
-                 fields[r][c + 1] == fields[r][c + 2] )
-            {
-                merge3(grp, crd, w*r + c + 0, w*r + c + 1, w*r + c + 2);
-                score = 1;
-            }
-        }
-    }
+    chunk.c     = (unsigned char)c;
+    chunk.r1    = log->saved[c];
+    chunk.r2    = (unsigned char)(r + 1);
+    chunk.first = (chunk.r1 == 0);
 
-    /* Find vertical groups of length at least 3 */
-    for (c = w - 1; c >= 0; --c)
+    p = log->data + log->size;
+    memcpy(p, &chunk, sizeof(chunk));
+    p += sizeof(chunk);
+    if (chunk.first)
     {
-        for (r = h - 3; r >= 0; --r)
-        {
-            if (fields[r][c] <= FIELD_EMPTY) continue;
-
-            if ( fields[r + 0][c] == fields[r + 1][c] &&
-                 fields[r + 1][c] == fields[r + 2][c] )
-            {
-                merge3(grp, crd, w*(r + 0) + c, w*(r + 1) + c, w*(r + 2) + c);
-                score = 1;
-            }
-        }
+        memcpy(p, &board->drops[c], sizeof(Field*));
+        p += sizeof(Field*);
     }
-
-    if (!score) return 0;
-
-    /* Determine scores and remove marked fields.
-       Groups of size 3, 4, 5+ are worth 50, 100, 250 points respectively. */
-    score = 0;
-    for (r = 0; r < h; ++r)
+    for (r = chunk.r1; r < chunk.r2; ++r)
     {
-        for (c = 0; c < w; ++c)
-        {
-            int u = find(grp, w*r + c);
-            if (crd[u] < 3) continue;
-
-            if (u == w*r + c)
-            {
-                if (crd[u] == 3)
-                {
-                    score += 50;
-                }
-                else
-                if (crd[u] == 4)
-                {
-                    score += 100;
-                }
-                else /* crd[u] >= 5 */
-                {
-                    score += 250;
-                }
-            }
-            fields[r][c] = FIELD_EMPTY;
-        }
+        *p++ = (unsigned char)FLD(board, r, c);
     }
-
-    return score;
+    log->size = p - log->data;
+    log->saved[c] = chunk.r2;
 }
 
-/* Compact columns (filling empty fields) and fill them up at the top with
-   dropped blocks. */
-static void fill_columns(Board *board, Rect *area)
+/* State of a cascade of removals, as saved for cycle detection */
+typedef struct CascadeState
 {
-    int c, r1, r2;
-    Rect new_area = { 0, WID(board) - 1, 0, 0 };
-    for (c = area->c1; c < area->c2; ++c)
-    {
-        /* Find first empty spot */
-        for (r2 = area->r2 - 1; r2 >= area->r1; --r2)
-        {
-            if (FLD(board, r2, c) == FIELD_EMPTY) break;
-        }
-
-        if (r2 < area->r1) continue; /* no empty spots in this column */
-
-        /* Expand new area */
-        if (c < new_area.c1) new_area.c1 = c;
-        if (c >= new_area.c2) new_area.c2 = c + 1;
-        if (r2 >= new_area.r2) new_area.r2 = r2 + 1;
-
-        /* Drop down fields on empty spot */
-        for (r1 = r2 - 1; r1 >= 0; --r1)
-        {
-            if (FLD(board, r1, c) != FIELD_EMPTY)
-            {
-                FLD(board, r2, c) = FLD(board, r1, c);
-                r2 -= 1;
-            }
-        }
-
-        /* Fill up on the top */
-        for ( ; r2 >= 0; --r2)
-        {
-            FLD(board, r2, c) = *board->drops[c]++;
-            if (board->drops[c] == board->game->drops_end[c])
-            {
-                board->drops[c] = board->game->drops_begin[c];
-            }
-        }
-    }
-
-    area->r1 = max(0, new_area.r1 - 2);
-    area->c1 = max(0, new_area.c1 - 2);
-    area->r2 = min(HIG(board), new_area.r2 + 3);
-    area->c2 = min(WID(board),  new_area.c2 + 3);
-}
-
-/* Finds scoring rows on the board, and removes them, repeating the process
-   while scoring rows exist. The total score is returned (or MAX_SCORE, if the
-   total score would equal or exceed MAX_SCORE).
+    Field fields[(MAX_HEIGHT - 1)*MAX_STRIDE + MAX_WIDTH];
+    Field *drops[MAX_WIDTH];
+    Rect area;
+} CascadeState;
 
-   Area is used as the area of interest (which may be only a small part of
-   the board that has changed).
-*/
-static int board_score(Board *board, Rect *area)
+/* Board engine: functions specialised for one board size (see GameEngine.h)
+   or the generic engine (with width and height zero) */
+typedef struct Engine
+{
+    int width, height, stride;
+    int (*board_score)(Board *board, Rect *area, UndoLog *log);
+    void (*copy_fields)(Board *dst, const Board *src);
+    unsigned long long (*hash_board)(const Board *board);
+    int (*equal_boards)(const Board *a, const Board *b);
+} Engine;
+
+/* Mixes a 64-bit word into an FNV-1a variant hash (used by hash_board()) */
+#define HASH_WORD(hash, w) \
+    ((hash) = ((hash) ^ (w))*1099511628211ULL, (hash) ^= (hash) >> 32)
+
+/* Generic engine */
+#define ENGINE_NAME(name)   name##_generic
+#define ENGINE_WIDTH(b)     ((b)->game->width)
+#define ENGINE_HEIGHT(b)    ((b)->game->height)
+#define ENGINE_STRIDE(b)    ((b)->game->stride)
+#include "GameEngine.h"
+
+/* Engine for 8x8 boards */
+#define ENGINE_NAME(name)   name##_8x8
+#define ENGINE_WIDTH(b)     (8)
+#define ENGINE_HEIGHT(b)    (8)
+#define ENGINE_STRIDE(b)    (16)
+#include "GameEngine.h"
+
+/* Engine for 10x10 boards */
+#define ENGINE_NAME(name)   name##_10x10
+#define ENGINE_WIDTH(b)     (10)
+#define ENGINE_HEIGHT(b)    (10)
+#define ENGINE_STRIDE(b)    (16)
+#include "GameEngine.h"
+
+/* Engine for 20x20 boards */
+#define ENGINE_NAME(name)   name##_20x20
+#define ENGINE_WIDTH(b)     (20)
+#define ENGINE_HEIGHT(b)    (20)
+#define ENGINE_STRIDE(b)    (32)
+#include "GameEngine.h"
+
+/* Available engines; the generic engine comes last */
+static const Engine engines[] = {
+    {  8,  8, 16, board_score_8x8, copy_fields_8x8,
+                  hash_board_8x8, equal_boards_8x8 },
+    { 10, 10, 16, board_score_10x10, copy_fields_10x10,
+                  hash_board_10x10, equal_boards_10x10 },
+    { 20, 20, 32, board_score_20x20, copy_fields_20x20,
+                  hash_board_20x20, equal_boards_20x20 },
+    {  0,  0,  0, board_score_generic, copy_fields_generic,
+                  hash_board_generic, equal_boards_generic } };
+
+/* Select the engine for the dimensions of a game */
+static const Engine *select_engine(const Game *game)
 {
-    int total_score, score, iterations;
+    const Engine *engine = engines;
 
-    iterations = total_score = 0;
-    while ((score = remove_groups(board, area)) > 0)
-    {
-        fill_columns(board, area);
-        total_score += score;
-        if (board->score + total_score >= SCORE_LIMIT) break;
-        if (++iterations == 10000)
-        {
-            /* Let's assume we're in an infinite loop */
-            total_score = SCORE_LIMIT;
-            break;
-        }
-    }
-    board->score += total_score;
-    if (board->score > SCORE_LIMIT) board->score = SCORE_LIMIT;
+    while ( engine->width != 0 && (engine->width != game->width ||
+            engine->height != game->height) ) ++engine;
+    assert(engine->width == 0 || engine->stride == game->stride);
 
-    return total_score;
+    return engine;
 }
 
 /* Swap fields at given positions */
@@ -274,24 +299,83 @@ failed:
     return NULL;
 }
 
-static Board *board_alloc(Game *game)
+size_t board_size(const Game *game)
+{
+    return sizeof(Board) + (game->height + 2*BORDER)*game->stride*sizeof(Field)
+                         + game->width*sizeof(Field*);
+}
+
+static Board *board_alloc(Game *game, const char *file, int line)
 {
     char *data;
     Board *board;
 
-    data = malloc( sizeof(Board) +
-                   game->height*game->width*sizeof(Field) +
-                   game->width*sizeof(Field*) );
+    if (num_pools > 0)
+    {
+        /* Take a board from the pool of the current node */
+        BoardPool *pool = &pools[thread_node];
+        board = NULL;
+        LOCK(pool->lock);
+        if (pool->size > 0) board = pool->boards[--pool->size];
+        UNLOCK(pool->lock);
+        if (board != NULL && board->game == game)
+        {
+            __sync_fetch_and_add(&board_bytes, board_size(game));
+            return board;
+        }
+        free(board);
+    }
+
+    data = site_malloc(file, line, board_size(game));
 
     if (data == NULL) return NULL;
+    __sync_fetch_and_add(&board_bytes, board_size(game));
 
     board = (Board*)data;
     board->drops  = (Field**)(data + sizeof(Board));
     board->fields = (Field*)(data + sizeof(Board) + game->width*sizeof(Field*));
+    board->pool   = num_pools > 0 ? thread_node : -1;
+
+    /* Block all fields, including the border (which is never changed, so
+       boards taken from a pool above keep it) */
+    memset( board->fields, FIELD_BLOCKED,
+            (game->height + 2*BORDER)*game->stride*sizeof(Field) );
+    board->fields += BORDER*game->stride + BORDER;
 
     return board;
 }
 
+void board_pool_init(int num_nodes)
+{
+    int n;
+
+    if (num_nodes > MAX_NODES) num_nodes = MAX_NODES;
+    for (n = 0; n < num_nodes; ++n)
+    {
+        pools[n].size = 0;
+        pools[n].boards = malloc(POOL_CAPACITY*sizeof(Board*));
+        if (pools[n].boards == NULL) break;
+    }
+    num_pools = n;
+}
+
+void board_pool_set_node(int node)
+{
+    thread_node = (node >= 0 && node < num_pools) ? node : 0;
+}
+
+void board_pool_destroy()
+{
+    int n;
+
+    for (n = 0; n < num_pools; ++n)
+    {
+        while (pools[n].size > 0) free(pools[n].boards[--pools[n].size]);
+        free(pools[n].boards);
+    }
+    num_pools = 0;
+}
+
 static bool read_fields(Game *game, const char *path)
 {
     char *buf;
@@ -322,16 +406,23 @@ static bool read_fields(Game *game, const char *path)
     game->drops_end   = malloc(game->width*sizeof(Field*));
     if (game->drops_begin == NULL || game->drops_end == NULL) return false;
 
+    /* Rows are padded with the border to a power of two */
+    for (game->stride = 1; game->stride < game->width + 2*BORDER; )
+    {
+        game->stride *= 2;
+    }
+    game->engine = select_engine(game);
+
     /* Allocate initial board */
-    game->initial = board_alloc(game);
+    game->initial = board_alloc(game, __FILE__, __LINE__);
     game->initial->game = game;
     game->initial->moves = 0;
     game->initial->score = 0;
     game->initial->last_move = NULL;
+    game->initial->dead_regions = 0;
 
     /* Initialize fields */
     r = c = 0;
-    memset(game->initial->fields, FIELD_BLOCKED, game->width*game->height);
     for (n = 0; n < len; ++n)
     {
         if (buf[n] >= '0' && buf[n] <= '1')
@@ -422,6 +513,64 @@ failed:
     return false;
 }
 
+/* Divide the board into regions separated by columns that are blocked
+   entirely. If there are more than MAX_REGIONS regions, the last region
+   includes all remaining columns. */
+static void find_regions(Game *game)
+{
+    int r, c;
+    bool blocked, open = false;
+
+    game->num_regions = 0;
+    for (c = 0; c < game->width; ++c)
+    {
+        blocked = true;
+        for (r = 0; r < game->height; ++r)
+        {
+            if (FLD(game->initial, r, c) != FIELD_BLOCKED) blocked = false;
+        }
+        if (!blocked && !open)
+        {
+            /* Start a new region (or extend the last one) */
+            if (game->num_regions < MAX_REGIONS)
+            {
+                game->regions[game->num_regions++].c1 = c;
+            }
+            open = true;
+        }
+        if (blocked) open = false;
+        if (open) game->regions[game->num_regions - 1].c2 = c + 1;
+        game->region[c] = max(game->num_regions - 1, 0);
+    }
+}
+
+/* Build the index of upcoming drop colours used by DROP_COLOURS() */
+static bool build_lookahead(Game *game)
+{
+    size_t size = game->drops_end[game->width - 1] - game->drops_begin[0];
+    unsigned short *mask;
+    const Field *f, *g;
+    int c, k;
+
+    game->lookahead = malloc(size*MAX_LOOKAHEAD*sizeof(unsigned short));
+    if (game->lookahead == NULL) return false;
+
+    for (c = 0; c < game->width; ++c)
+    {
+        for (f = game->drops_begin[c]; f != game->drops_end[c]; ++f)
+        {
+            mask = &game->lookahead[(f - game->drops_begin[0])*MAX_LOOKAHEAD];
+            for (g = f, k = 0; k < MAX_LOOKAHEAD; ++k)
+            {
+                mask[k] = (k > 0 ? mask[k - 1] : 0) | (1 << *g);
+                if (++g == game->drops_end[c]) g = game->drops_begin[c];
+            }
+        }
+    }
+
+    return true;
+}
+
 Game *game_load(const char *dir)
 {
     char oldwd[1024];
@@ -439,13 +588,16 @@ Game *game_load(const char *dir)
     /* Read field and column data */
     if (!read_fields(game, "speelveld.txt")) goto failed;
     if (!read_columns(game, "kolommen.txt")) goto failed;
+    if (!build_lookahead(game)) goto failed;
+    find_regions(game);
 
     /* Fill board and set initial score */
     area.r1 = area.c1 = 0;
     area.r2 = game->height;
     area.c2 = game->width;
-    fill_columns(game->initial, &area);
-    game->initial->score = board_score(game->initial, &area);
+    fill_columns_generic(game->initial, &area);
+    game->initial->score =
+        game->engine->board_score(game->initial, &area, NULL);
 
     /* Go back to old working dir */
     if (chdir(oldwd) != 0) goto failed;
@@ -463,6 +615,33 @@ failed:
     }
 }
 
+unsigned long long game_hash(const Game *game)
+{
+    /* 64-bit FNV-1a hash over dimensions, initial fields and drop lists */
+    unsigned long long hash = 14695981039346656037ULL;
+    const Field *f;
+    int r, c;
+
+#define HASH_BYTE(b) (hash = (hash ^ (unsigned char)(b))*1099511628211ULL)
+    HASH_BYTE(game->width);
+    HASH_BYTE(game->height);
+    for (r = 0; r < game->height; ++r)
+    {
+        for (c = 0; c < game->width; ++c) HASH_BYTE(FLD(game->initial, r, c));
+    }
+    for (c = 0; c < game->width; ++c)
+    {
+        for (f = game->drops_begin[c]; f != game->drops_end[c]; ++f)
+        {
+            HASH_BYTE(*f);
+        }
+        HASH_BYTE(FIELD_BLOCKED);   /* column separator */
+    }
+#undef HASH_BYTE
+
+    return hash;
+}
+
 void game_free(Game *game)
 {
     if (game != NULL)
@@ -476,15 +655,81 @@ void game_free(Game *game)
         {
             free(game->drops_end);
         }
+        free(game->lookahead);
         board_free(game->initial);
         free(game);
     }
 }
 
+/* Count a call to board_move_logged() by the calling thread. */
+static void count_move()
+{
+    static int num_counters;
+    static __thread MoveCounter *local;
+
+    if (local == NULL)
+    {
+        int i = __sync_fetch_and_add(&num_counters, 1);
+        local = &move_counters[i < MAX_THREADS ? i : MAX_THREADS];
+    }
+    __sync_fetch_and_add(&local->count, 1);
+}
+
+unsigned long long board_move_count()
+{
+    unsigned long long total = 0;
+    int i;
+
+    for (i = 0; i <= MAX_THREADS; ++i)
+    {
+        total += __sync_fetch_and_add(&move_counters[i].count, 0);
+    }
+    return total;
+}
+
 int board_move(Board *board, int r1, int c1, int r2, int c2, int trace)
+{
+    return board_move_logged(board, r1, c1, r2, c2, trace, NULL);
+}
+
+/* Returns the maximum size of a single undo record for the game: every
+   field is saved at most once, in at most one chunk per field. */
+static size_t undo_record_max(const Game *game)
+{
+    return game->width*game->height*(1 + sizeof(UndoChunk)) +
+           game->width*sizeof(Field*) + sizeof(UndoRecord);
+}
+
+int board_move_logged( Board *board, int r1, int c1, int r2, int c2,
+                       int trace, UndoLog *log )
 {
     int score;
     Rect area;
+    UndoRecord rec;
+    size_t begin = 0;
+
+    count_move();
+    if (log != NULL)
+    {
+        size_t needed = log->size + undo_record_max(board->game);
+        if (needed > log->capacity)
+        {
+            size_t capacity = 2*log->capacity > needed ? 2*log->capacity
+                                                       : needed;
+            unsigned char *data = realloc(log->data, capacity);
+            if (data == NULL) return -1;
+            log->data     = data;
+            log->capacity = capacity;
+        }
+        memset(log->saved, 0, WID(board));
+        begin         = log->size;
+        rec.last_move = board->last_move;
+        rec.score     = board->score;
+        rec.moves     = board->moves;
+        rec.dead_regions = board->dead_regions;
+        rec.r1 = r1, rec.c1 = c1, rec.r2 = r2, rec.c2 = c2;
+        rec.trace     = trace != 0;
+    }
 
     area.r1 = max(0, min(r1, r2) - 2);
     area.c1 = max(0, min(c1, c2) - 2);
@@ -492,21 +737,22 @@ int board_move(Board *board, int r1, int c1, int r2, int c2, int trace)
     area.c2 = min(WID(board), max(c1, c2) + 3);
 
     swap_fields(board, r1, c1, r2, c2);
-    score = board_score(board, &area);
+    score = board->game->engine->board_score(board, &area, log);
     if (score > 0)
     {
+        if (log != NULL)
+        {
+            rec.length = log->size - begin + sizeof(rec);
+            memcpy(log->data + log->size, &rec, sizeof(rec));
+            log->size += sizeof(rec);
+            ++log->count;
+        }
         ++board->moves;
         if (trace)
         {
-            Move *new_move = malloc(sizeof(Move));
+            Move *new_move = move_create(board->last_move, r1, c1, r2, c2);
             /* FIXME: this should be externally detectable */
             assert(new_move != NULL);
-            new_move->prev = board->last_move;
-            new_move->ref_count = 1;
-            new_move->r1 = r1;
-            new_move->c1 = c1;
-            new_move->r2 = r2;
-            new_move->c2 = c2;
             board->last_move = new_move;
         }
         else
@@ -523,20 +769,101 @@ int board_move(Board *board, int r1, int c1, int r2, int c2, int trace)
     return score;
 }
 
-Board *board_clone(Board *board)
+void board_undo(Board *board, UndoLog *log)
+{
+    UndoRecord rec;
+    UndoChunk chunk;
+    unsigned char *p, *end;
+    int r;
+
+    assert(log->count > 0);
+    end = log->data + log->size - sizeof(rec);
+    memcpy(&rec, end, sizeof(rec));
+
+    /* Restore saved parts of columns (which are disjoint, so the order in
+       which they are restored does not matter) */
+    for (p = end + sizeof(rec) - rec.length; p < end; )
+    {
+        memcpy(&chunk, p, sizeof(chunk));
+        p += sizeof(chunk);
+        if (chunk.first)
+        {
+            memcpy(&board->drops[chunk.c], p, sizeof(Field*));
+            p += sizeof(Field*);
+        }
+        for (r = chunk.r1; r < chunk.r2; ++r) FLD(board, r, chunk.c) = *p++;
+    }
+
+    /* The saved fields include the swap, so undo it last */
+    swap_fields(board, rec.r1, rec.c1, rec.r2, rec.c2);
+
+    if (rec.trace)
+    {
+        /* Release the move trace node created for the move (which holds a
+           reference to the previous move) */
+        Move *move = board->last_move;
+        board->last_move = move_ref(rec.last_move);
+        move_deref(move);
+    }
+    else
+    {
+        board->last_move = rec.last_move;
+    }
+    board->score = rec.score;
+    board->moves = rec.moves;
+    board->dead_regions = rec.dead_regions;
+
+    log->size -= rec.length;
+    --log->count;
+}
+
+UndoLog *undo_create()
+{
+    UndoLog *log = malloc(sizeof(UndoLog));
+    if (log != NULL) memset(log, 0, sizeof(UndoLog));
+    return log;
+}
+
+void undo_destroy(UndoLog *log)
+{
+    if (log != NULL)
+    {
+        free(log->data);
+        free(log);
+    }
+}
+
+void undo_forget(UndoLog *log, int keep)
+{
+    UndoRecord rec;
+    size_t pos = log->size;
+    int n;
+
+    if (keep >= log->count) return;
+    for (n = 0; n < keep; ++n)
+    {
+        memcpy(&rec, log->data + pos - sizeof(rec), sizeof(rec));
+        pos -= rec.length;
+    }
+    memmove(log->data, log->data + pos, log->size - pos);
+    log->size -= pos;
+    log->count = keep;
+}
+
+Board *board_clone_at(const char *file, int line, Board *board)
 {
     Board *clone;
 
-    clone = board_alloc(board->game);
+    clone = board_alloc(board->game, file, line);
     if (clone != NULL)
     {
         clone->game = board->game;
-        memcpy( clone->fields, board->fields,
-            clone->game->width*clone->game->height*sizeof(*clone->fields) );
+        clone->game->engine->copy_fields(clone, board);
         memcpy( clone->drops, board->drops,
             clone->game->width*sizeof(*clone->drops) );
         clone->score = board->score;
         clone->moves = board->moves;
+        clone->dead_regions = board->dead_regions;
         clone->last_move = board->last_move;
         if (clone->last_move != NULL) move_ref(clone->last_move);
     }
@@ -544,6 +871,28 @@ Board *board_clone(Board *board)
     return clone;
 }
 
+void board_copy(Board *dst, const Board *src)
+{
+    assert(dst->game == src->game);
+    src->game->engine->copy_fields(dst, src);
+    memcpy(dst->drops, src->drops, WID(src)*sizeof(*dst->drops));
+    dst->score = src->score;
+    dst->moves = src->moves;
+    dst->dead_regions = src->dead_regions;
+    dst->last_move = NULL;
+}
+
+unsigned long long board_hash(const Board *board)
+{
+    return board->game->engine->hash_board(board);
+}
+
+int board_equal(const Board *a, const Board *b)
+{
+    assert(a->game == b->game);
+    return a->game->engine->equal_boards(a, b);
+}
+
 void board_dump(Board *board, void *fp)
 {
     int r, c;
@@ -585,29 +934,115 @@ void board_dump(Board *board, void *fp)
     }
 }
 
-Move *move_ref(Move *move)
+Move *move_create_at( const char *file, int line,
+                      Move *prev, int r1, int c1, int r2, int c2 )
 {
+    Move *move = site_malloc(file, line, sizeof(Move));
     if (move != NULL)
     {
-        #pragma omp atomic
-        move->ref_count += 1;
+        __sync_fetch_and_add(&move_bytes, sizeof(Move));
+        move->prev = prev;
+        move->ref_count = 1;
+        move->r1 = r1;
+        move->c1 = c1;
+        move->r2 = r2;
+        move->c2 = c2;
     }
     return move;
 }
 
-void move_deref(Move *move)
+Move *move_ref(Move *move)
 {
-    Move *prev;
+    if (move != NULL) __sync_fetch_and_add(&move->ref_count, 1);
+    return move;
+}
 
-    while (move != NULL)
+/* Returns the calling thread's queue of dead moves, or NULL if all queues
+   are in use by other threads. */
+static DeadMoves *dead_moves_local()
+{
+    static int num_queues;
+    static __thread DeadMoves *local;
+    static __thread bool assigned;
+
+    if (!assigned)
     {
-        assert(move->ref_count > 0);
-        #pragma omp atomic
-        move->ref_count -= 1;
-        if (move->ref_count > 0) break;
-        prev = move->prev;
+        int i = __sync_fetch_and_add(&num_queues, 1);
+        local = i < MAX_THREADS ? &dead_moves[i] : NULL;
+        assigned = true;
+    }
+    return local;
+}
+
+/* Free up to `limit' moves from the given queue, dereferencing their
+   predecessors (which are added to the queue when they die as well). */
+static void dead_moves_free(DeadMoves *dm, size_t limit)
+{
+    while (dm->size > 0 && limit-- > 0)
+    {
+        Move *move = dm->moves[--dm->size];
+        Move *prev = move->prev;
         free(move);
-        move = prev;
+        __sync_fetch_and_sub(&move_bytes, sizeof(Move));
+        if (prev != NULL && __sync_sub_and_fetch(&prev->ref_count, 1) == 0)
+        {
+            dm->moves[dm->size++] = prev;
+        }
+    }
+}
+
+void move_deref(Move *move)
+{
+    DeadMoves *dm;
+
+    if (move == NULL) return;
+    assert(move->ref_count > 0);
+    if (__sync_sub_and_fetch(&move->ref_count, 1) > 0) return;
+
+    /* Move is dead; queue it for deferred reclamation */
+    dm = dead_moves_local();
+    if (dm != NULL && dm->size == dm->capacity)
+    {
+        size_t new_capacity = dm->capacity ? 2*dm->capacity : 1024;
+        Move **new_moves = realloc(dm->moves, new_capacity*sizeof(Move*));
+        if (new_moves != NULL)
+        {
+            dm->moves    = new_moves;
+            dm->capacity = new_capacity;
+        }
+    }
+    if (dm == NULL || dm->size == dm->capacity)
+    {
+        /* No queue available; free the chain immediately */
+        DeadMoves tmp;
+        tmp.moves    = &move;
+        tmp.size     = 1;
+        tmp.capacity = 1;
+        while (tmp.size > 0) dead_moves_free(&tmp, 1);
+        return;
+    }
+    dm->moves[dm->size++] = move;
+    dead_moves_free(dm, RECLAIM_BATCH);
+}
+
+void move_reclaim()
+{
+    int i;
+    for (i = 0; i < MAX_THREADS; ++i)
+    {
+        dead_moves_free(&dead_moves[i], (size_t)-1);
+    }
+}
+
+void move_reclaim_all()
+{
+    int i;
+    move_reclaim();
+    for (i = 0; i < MAX_THREADS; ++i)
+    {
+        free(dead_moves[i].moves);
+        dead_moves[i].moves    = NULL;
+        dead_moves[i].capacity = 0;
     }
 }
 
@@ -616,24 +1051,56 @@ void board_free(Board *board)
     if (board != NULL)
     {
         move_deref(board->last_move);
+        __sync_fetch_and_sub(&board_bytes, board_size(board->game));
+        if (board->pool >= 0 && board->pool < num_pools)
+        {
+            /* Return the board to the pool of the node it was allocated on */
+            BoardPool *pool = &pools[board->pool];
+            LOCK(pool->lock);
+            if (pool->size < POOL_CAPACITY)
+            {
+                pool->boards[pool->size++] = board;
+                board = NULL;
+            }
+            UNLOCK(pool->lock);
+        }
         free(board);
     }
 }
 
-/* NOTE: this function uses a lot of stack space:
-         390KB (32-bit) or 781KB (64-bit) when MOVE_LIMIT == 100000 */
-void moves_print(Move *move, void *fp)
+size_t board_memory_used()
 {
-    Move *moves[MOVE_LIMIT];
-    size_t size;
+    return board_bytes;
+}
+
+size_t move_memory_used()
+{
+    return move_bytes;
+}
+
+/* Store the moves of a trace in `moves' (last move first) and return the
+   number of moves. */
+static size_t moves_collect(Move *move, Move **moves)
+{
+    size_t size = 0;
 
-    size = 0;
     while (move != NULL)
     {
         moves[size++] = move;
         move = move->prev;
     }
 
+    return size;
+}
+
+/* NOTE: this function uses a lot of stack space:
+         390KB (32-bit) or 781KB (64-bit) when MOVE_LIMIT == 100000 */
+void moves_print(Move *move, void *fp)
+{
+    Move *moves[MOVE_LIMIT];
+    size_t size;
+
+    size = moves_collect(move, moves);
     while (size > 0)
     {
         move = moves[--size];
@@ -642,3 +1109,104 @@ void moves_print(Move *move, void *fp)
                  (move->r1 == move->r2) ? 'O' : 'Z' );
     }
 }
+
+/* NOTE: uses as much stack space as moves_print() */
+void moves_print_binary(const Game *game, Move *move, void *fp)
+{
+    Move *moves[MOVE_LIMIT];
+    size_t size;
+    unsigned v;
+    int r, c;
+
+    fputs(TRACE_MAGIC, fp);
+    size = moves_collect(move, moves);
+    while (size > 0)
+    {
+        /* Moves are encoded by their top/left cell, which need not be the
+           first one given (e.g. for moves replayed from a text trace). */
+        move = moves[--size];
+        r = move->r1 < move->r2 ? move->r1 : move->r2;
+        c = move->c1 < move->c2 ? move->c1 : move->c2;
+        v = 2*(r*game->width + c) + (move->r1 != move->r2);
+        while (v >= 0x80)
+        {
+            putc((v & 0x7f) | 0x80, fp);
+            v >>= 7;
+        }
+        putc(v, fp);
+    }
+}
+
+int move_read_binary( void *fp, const Game *game,
+                      int *r1, int *c1, int *r2, int *c2 )
+{
+    unsigned v = 0;
+    int ch, shift;
+
+    for (shift = 0; shift < 28; shift += 7)
+    {
+        if ((ch = getc(fp)) == EOF) return shift == 0 ? 0 : -1;
+        v |= (unsigned)(ch & 0x7f) << shift;
+        if (!(ch & 0x80))
+        {
+            if (v/2 >= (unsigned)(game->width*game->height)) return -1;
+            *r1 = v/2/game->width;
+            *c1 = v/2%game->width;
+            *r2 = *r1 + (v & 1);
+            *c2 = *c1 + !(v & 1);
+            return *r2 < game->height && *c2 < game->width ? 1 : -1;
+        }
+    }
+
+    return -1;
+}
+
+/* Replay moves in the binary trace format (see moves_replay()) */
+static int moves_replay_binary(Board *board, void *fp)
+{
+    int moves, r1, c1, r2, c2, res;
+
+    for (moves = 0; ; ++moves)
+    {
+        res = move_read_binary(fp, board->game, &r1, &c1, &r2, &c2);
+        if (res == 0) return moves;
+        if ( res < 0 || moves == MOVE_LIMIT ||
+             FLD(board, r1, c1) <= 0 || FLD(board, r2, c2) <= 0 ||
+             board_move(board, r1, c1, r2, c2, 1) == 0 )
+        {
+            return -1;
+        }
+    }
+}
+
+int moves_replay(Board *board, void *fp)
+{
+    int moves, x1, y1, x2, y2;
+    char dir, magic[sizeof(TRACE_MAGIC) - 1];
+
+    /* Detect the binary format */
+    if ((x1 = getc(fp)) == TRACE_MAGIC[0])
+    {
+        magic[0] = (char)x1;
+        if ( fread(magic + 1, 1, sizeof(magic) - 1, fp) != sizeof(magic) - 1 ||
+             memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ) return -1;
+        return moves_replay_binary(board, fp);
+    }
+    if (x1 != EOF) ungetc(x1, fp);
+
+    for (moves = 0; fscanf(fp, " %d %d %c", &x1, &y1, &dir) == 3; ++moves)
+    {
+        x2 = x1 + (dir == 'O') - (dir == 'W');
+        y2 = y1 + (dir == 'Z') - (dir == 'N');
+        if ( moves == MOVE_LIMIT || (x1 == x2 && y1 == y2) ||
+             x1 < 0 || x1 >= WID(board) || y1 < 0 || y1 >= HIG(board) ||
+             x2 < 0 || x2 >= WID(board) || y2 < 0 || y2 >= HIG(board) ||
+             FLD(board, y1, x1) <= 0 || FLD(board, y2, x2) <= 0 ||
+             board_move(board, y1, x1, y2, x2, 1) == 0 )
+        {
+            return -1;
+        }
+    }
+
+    return feof((FILE*)fp) ? moves : -1;
+}
@@ -1,10 +1,16 @@
 #ifndef GAME_H_INCLUDED
 #define GAME_H_INCLUDED
 
+#include <stddef.h>
+
 #define SCORE_LIMIT   (1000000000)  /* max. score; if you reach this, you win */
 #define MOVE_LIMIT    (100000)      /* max. moves; if you reach this, you win */
 #define MAX_HEIGHT    (50)          /* max. field height */
 #define MAX_WIDTH     (50)          /* max. field width */
+#define BORDER        (2)           /* width of border around the fields */
+#define MAX_STRIDE    (64)          /* max. distance between rows */
+#define MAX_LOOKAHEAD (8)           /* max. drops indexed by DROP_COLOURS */
+#define MAX_REGIONS   (32)          /* max. independent regions of a board */
 
 
 /* Fields are represented by a byte; -1 for blocked fields, 0 for empty fields,
@@ -30,20 +36,55 @@ typedef struct Board
     int score;              /* total score so far */
     int moves;              /* total moves performed so far */
     Move *last_move;        /* last move (or NULL for initial board) */
+    int pool;               /* pool the board returns to (-1 for none) */
+    unsigned dead_regions;  /* regions known to have no valid moves */
 } Board;
 
+/* Log of changes made by moves, which allows moves to be undone in place.
+   For each move, the log records the original contents of the part of each
+   column that was changed, the original drop list positions, and the score,
+   move count and last move before the move. */
+typedef struct UndoLog
+{
+    unsigned char *data;            /* records of moves, oldest first */
+    size_t size, capacity;          /* used and allocated size of data */
+    int count;                      /* number of moves recorded */
+    unsigned char saved[MAX_WIDTH]; /* rows saved per column (during move) */
+} UndoLog;
+
+/* A range of columns of the board (c1 through c2, exclusive) bounded by
+   columns that are blocked entirely, or by the edges of the board. Since
+   blocks only drop within their column and rows of matching blocks cannot
+   cross blocked fields, moves in one region never affect another region. */
+typedef struct Region
+{
+    int c1, c2;
+} Region;
+
 /* Represents the static state of a game; i.e. the board dimensions,
-   available pieces and drop lists. */
+   available pieces and drop lists.
+
+   Internally, the fields of a board are surrounded by a border of BORDER
+   blocked fields on each side, and rows are `stride' fields apart (a power
+   of two). Code that looks at neighbouring fields can therefore step up to
+   BORDER fields off the board without checking bounds, since blocked fields
+   never match anything. */
 typedef struct Game
 {
     int width, height;      /* rectangular size of the board */
+    int stride;             /* distance between rows in the fields array */
+    const struct Engine *engine;    /* functions specialised for board size */
     Field **drops_begin;    /* for each column, a pointer to begin of the list */
     Field **drops_end;      /* for each column, a pointer to the end of list */
+    unsigned short *lookahead;  /* colours of upcoming drops (see below) */
+    int num_regions;                /* number of independent regions */
+    Region regions[MAX_REGIONS];    /* regions from left to right */
+    unsigned char region[MAX_WIDTH];    /* region of each column */
     Board *initial;         /* initial board */
 } Game;
 
 /* Macro to access fields in a game board; evaluates to an lvalue */
-#define FLD(b,r,c) ((b)->fields[(r)*((b)->game->width) + (c)])
+#define FLD(b,r,c) ((b)->fields[(r)*((b)->game->stride) + (c)])
 
 /* Macro to access the board width */
 #define WID(b) ((b)->game->width)
@@ -51,6 +92,12 @@ typedef struct Game
 /* Macro to access the board height */
 #define HIG(b) ((b)->game->height)
 
+/* Macro that evaluates to a bit mask of the colours of the next k blocks
+   (1 <= k <= MAX_LOOKAHEAD) that will drop into column c of the board, with
+   bit f set for field value f. The drop lists wrap around, as in the game. */
+#define DROP_COLOURS(b,c,k) ((b)->game->lookahead[ \
+    ((b)->drops[c] - (b)->game->drops_begin[0])*MAX_LOOKAHEAD + (k) - 1])
+
 /* Load a game definition from the given directory.
 
    If the game cannot be loaded for any reason (directory not found, missing
@@ -63,6 +110,10 @@ Game *game_load(const char *dir);
 /* Free a board loaded with board_load. */
 void game_free(Game *game);
 
+/* Compute a hash of the game definition (field layout and drop lists), which
+   identifies the game independently of the directory it was loaded from. */
+unsigned long long game_hash(const Game *game);
+
 /* Perform a move and return the score for this move; if this is zero, no
    scoring rows are formed and the move has not been executed.
 
@@ -71,21 +122,136 @@ void game_free(Game *game);
 */
 int board_move(Board *board, int r1, int c1, int r2, int c2, int trace);
 
+/* Perform a move like board_move(), and if it scores, record it in the undo
+   log so it can be undone later with board_undo(). The log must only contain
+   moves performed on the same board.
+
+   The log grows as needed; the size of a record is bounded by the size of
+   the board, so once the log has reached its working size, no memory is
+   allocated anymore. If the log cannot be grown, -1 is returned and the
+   board is left unchanged. */
+int board_move_logged( Board *board, int r1, int c1, int r2, int c2,
+                       int trace, UndoLog *log );
+
+/* Undo the last move recorded in the undo log, restoring the board exactly
+   to its state before the move. If the move was traced, the reference to its
+   move trace node is released. The log must not be empty. (To redo a move,
+   simply perform it again: moves are deterministic.) */
+void board_undo(Board *board, UndoLog *log);
+
+/* Create an empty undo log, or return NULL if memory allocation fails. */
+UndoLog *undo_create();
+
+/* Destroy an undo log. */
+void undo_destroy(UndoLog *log);
+
+/* Discard all but the `keep' most recently recorded moves from the log. */
+void undo_forget(UndoLog *log, int keep);
+
 /* Clone a board, or return NULL if memory allocation fails.
-   The board returned must be freed with board_free(). */
-Board *board_clone(Board *board);
+   The board returned must be freed with board_free(). With MEM_DEBUG, the
+   allocation is attributed to the caller's `file' and `line'. */
+Board *board_clone_at(const char *file, int line, Board *board);
+#define board_clone(board) board_clone_at(__FILE__, __LINE__, board)
+
+/* Copy the state of a board into another board of the same game, without
+   allocating memory. Trace information is not copied: the last move of the
+   destination board is set to NULL (without releasing its reference, so
+   this should only be used on scratch boards created without a trace). */
+void board_copy(Board *dst, const Board *src);
+
+/* Compute a hash of the state of a board: its fields and drop list
+   positions (but not its score, move count or trace). */
+unsigned long long board_hash(const Board *board);
+
+/* Return whether two boards of the same game have the same fields and drop
+   list positions. */
+int board_equal(const Board *a, const Board *b);
 
 /* Free a board. */
 void board_free(Board *board);
 
+/* Enable pools of free boards, one for each of `num_nodes' NUMA nodes.
+   Boards are then allocated from the pool of the calling thread's node, and
+   freed boards return to the pool of the node they were allocated on, so
+   board memory stays on the node of the thread that first touched it.
+   Must be called before any other threads allocate boards. */
+void board_pool_init(int num_nodes);
+
+/* Set the NUMA node of the calling thread (used to select a board pool). */
+void board_pool_set_node(int node);
+
+/* Free all pooled boards and disable the pools. Must not be called while
+   other threads may allocate or free boards. */
+void board_pool_destroy();
+
+/* Return the number of bytes allocated for a single board of the game. */
+size_t board_size(const Game *game);
+
+/* Return the total number of bytes currently allocated for boards and for
+   move trace nodes, respectively. */
+size_t board_memory_used();
+size_t move_memory_used();
+
+/* Return the total number of calls to board_move() and board_move_logged()
+   made by all threads so far. Counts of other threads may lag behind while
+   they are still performing moves. */
+unsigned long long board_move_count();
+
 /* For debugging: dump the board configuration in a human-readable format. */
 void board_dump(Board *board, void *fp);
 
 /* Print a list of at most MOVE_LIMIT moves to the given file pointer */
 void moves_print(Move *last_move, void *fp);
 
-/* Reference counting for moves */
+/* Binary trace format: the magic number TRACE_MAGIC, followed by one varint
+   per move (7 bits per byte, least significant first, with the high bit set
+   in all but the last byte) with value 2*(r1*width + c1) + (r1 != r2);
+   i.e. the index of the top/left position and the direction. */
+#define TRACE_MAGIC "BJTR"
+
+/* Print a list of at most MOVE_LIMIT moves for the given game to the given
+   file pointer in the binary trace format. */
+void moves_print_binary(const Game *game, Move *last_move, void *fp);
+
+/* Read the next move in the binary trace format (after the magic number)
+   from the given file pointer. Returns 1 if a move was read, 0 at the end of
+   the input, or -1 if the input is malformed or the move lies outside the
+   board. */
+int move_read_binary( void *fp, const Game *game,
+                      int *r1, int *c1, int *r2, int *c2 );
+
+/* Read a list of moves in the format written by moves_print() or by
+   moves_print_binary() (which is detected automatically) from the given
+   file pointer and execute them on the board (with trace information).
+   Returns the number of moves executed, or -1 if the input is malformed or
+   contains an invalid move (in which case the board contains the moves
+   executed up to that point). */
+int moves_replay(Board *board, void *fp);
+
+/* Allocate a new move with a reference count of 1, or return NULL if memory
+   allocation fails. The new move takes over the caller's reference to
+   `prev' (which may be NULL). As with board_clone(), MEM_DEBUG attributes
+   the allocation to the caller. */
+Move *move_create_at( const char *file, int line,
+                      Move *prev, int r1, int c1, int r2, int c2 );
+#define move_create(prev, r1, c1, r2, c2) \
+    move_create_at(__FILE__, __LINE__, prev, r1, c1, r2, c2)
+
+/* Reference counting for moves. Reference counts are updated atomically, so
+   moves can be shared between threads. When the last reference to a move is
+   released, it is queued to be freed later by the releasing thread: each
+   call to move_deref() frees a small batch of queued moves, so releasing a
+   long trace does not stall the caller. */
 Move *move_ref(Move *move);
 void move_deref(Move *move);
 
+/* Free all dead moves queued by all threads, so they no longer count in
+   move_memory_used(). Must not be called while other threads may be
+   releasing moves. */
+void move_reclaim();
+
+/* Like move_reclaim(), but also release the queues themselves. */
+void move_reclaim_all();
+
 #endif /* ndef GAME_H_INCLUDED */
@@ -0,0 +1,293 @@
+/* Template for the board engine: the functions that find and remove
+   scoring groups, drop blocks, and copy, hash and compare the fields of
+   boards. Game.c includes this file once for every board size it has a
+   specialised engine for, and once for the generic engine, after defining:
+
+     ENGINE_NAME(name)  name of the instance of function `name'
+     ENGINE_WIDTH(b)    board width
+     ENGINE_HEIGHT(b)   board height
+     ENGINE_STRIDE(b)   distance between rows (see Game.h)
+
+   For specialised engines, the dimensions are constants, so the compiler can
+   unroll loops and inline copies of the fields. These macros are undefined
+   again at the end of the file.
+
+   NB. there is deliberately no include guard. */
+
+#define ENGINE_FLD(b,r,c) ((b)->fields[(r)*ENGINE_STRIDE(b) + (c)])
+#define ENGINE_SPAN(b) \
+    ((ENGINE_HEIGHT(b) - 1)*ENGINE_STRIDE(b) + ENGINE_WIDTH(b))
+
+#define remove_groups   ENGINE_NAME(remove_groups)
+#define fill_columns    ENGINE_NAME(fill_columns)
+#define cascade_save    ENGINE_NAME(cascade_save)
+#define cascade_equal   ENGINE_NAME(cascade_equal)
+#define board_score     ENGINE_NAME(board_score)
+#define copy_fields     ENGINE_NAME(copy_fields)
+#define hash_board      ENGINE_NAME(hash_board)
+#define equal_boards    ENGINE_NAME(equal_boards)
+
+/* Removes groups of blocks that form scoring rows (i.e. at least three
+   horizontally or vertically adjecent blocks)
+
+   Uses a disjoint-set data structure to identify overlapping groups.
+   If `log' is not NULL, fields are saved in the undo log before removal. */
+static int remove_groups(Board *board, Rect *area, UndoLog *log)
+{
+    int n, r, c, score;
+    int grp[MAX_HEIGHT*MAX_WIDTH];  /* group assignment for cells */
+    int crd[MAX_HEIGHT*MAX_WIDTH];  /* group cardinality for cells */
+    const int w = area->c2 - area->c1;
+    const int h = area->r2 - area->r1;
+    Field (* fields)[ENGINE_STRIDE(board)]; /* HACK: GCC extension (VLA) */
+
+    fields = (Field(*)[ENGINE_STRIDE(board)])
+             &ENGINE_FLD(board, area->r1, area->c1);
+
+    /* Create initial groups: each cell in its own group */
+    for (n = 0; n < w*h; ++n)
+    {
+        grp[n] = n;
+        crd[n] = 1;
+    }
+
+    score = 0;
+
+    /* Find horizontal groups of length at least 3 */
+    for (r = h - 1; r >= 0; --r)
+    {
+        for (c = w - 3; c >= 0; --c)
+        {
+            if (fields[r][c] <= FIELD_EMPTY) continue;
+
+            if ( fields[r][c + 0] == fields[r][c + 1] &&
+                 fields[r][c + 1] == fields[r][c + 2] )
+            {
+                merge3(grp, crd, w*r + c + 0, w*r + c + 1, w*r + c + 2);
+                score = 1;
+            }
+        }
+    }
+
+    /* Find vertical groups of length at least 3 */
+    for (c = w - 1; c >= 0; --c)
+    {
+        for (r = h - 3; r >= 0; --r)
+        {
+            if (fields[r][c] <= FIELD_EMPTY) continue;
+
+            if ( fields[r + 0][c] == fields[r + 1][c] &&
+                 fields[r + 1][c] == fields[r + 2][c] )
+            {
+                merge3(grp, crd, w*(r + 0) + c, w*(r + 1) + c, w*(r + 2) + c);
+                score = 1;
+            }
+        }
+    }
+
+    if (!score) return 0;
+
+    /* Determine scores and remove marked fields.
+       Groups of size 3, 4, 5+ are worth 50, 100, 250 points respectively. */
+    score = 0;
+    for (r = 0; r < h; ++r)
+    {
+        for (c = 0; c < w; ++c)
+        {
+            int u = find(grp, w*r + c);
+            if (crd[u] < 3) continue;
+
+            if (u == w*r + c)
+            {
+                if (crd[u] == 3)
+                {
+                    score += 50;
+                }
+                else
+                if (crd[u] == 4)
+                {
+                    score += 100;
+                }
+                else /* crd[u] >= 5 */
+                {
+                    score += 250;
+                }
+            }
+            if (log != NULL) undo_save(log, board, area->r1 + r, area->c1 + c);
+            fields[r][c] = FIELD_EMPTY;
+        }
+    }
+
+    return score;
+}
+
+/* Compact columns (filling empty fields) and fill them up at the top with
+   dropped blocks. */
+static void fill_columns(Board *board, Rect *area)
+{
+    int c, r1, r2;
+    Rect new_area = { 0, ENGINE_WIDTH(board) - 1, 0, 0 };
+    for (c = area->c1; c < area->c2; ++c)
+    {
+        /* Find first empty spot */
+        for (r2 = area->r2 - 1; r2 >= area->r1; --r2)
+        {
+            if (ENGINE_FLD(board, r2, c) == FIELD_EMPTY) break;
+        }
+
+        if (r2 < area->r1) continue; /* no empty spots in this column */
+
+        /* Expand new area */
+        if (c < new_area.c1) new_area.c1 = c;
+        if (c >= new_area.c2) new_area.c2 = c + 1;
+        if (r2 >= new_area.r2) new_area.r2 = r2 + 1;
+
+        /* Drop down fields on empty spot */
+        for (r1 = r2 - 1; r1 >= 0; --r1)
+        {
+            if (ENGINE_FLD(board, r1, c) != FIELD_EMPTY)
+            {
+                ENGINE_FLD(board, r2, c) = ENGINE_FLD(board, r1, c);
+                r2 -= 1;
+            }
+        }
+
+        /* Fill up on the top */
+        for ( ; r2 >= 0; --r2)
+        {
+            ENGINE_FLD(board, r2, c) = *board->drops[c]++;
+            if (board->drops[c] == board->game->drops_end[c])
+            {
+                board->drops[c] = board->game->drops_begin[c];
+            }
+        }
+    }
+
+    area->r1 = max(0, new_area.r1 - 2);
+    area->c1 = max(0, new_area.c1 - 2);
+    area->r2 = min(ENGINE_HEIGHT(board), new_area.r2 + 3);
+    area->c2 = min(ENGINE_WIDTH(board),  new_area.c2 + 3);
+}
+
+static void cascade_save( CascadeState *cs, const Board *board,
+                          const Rect *area )
+{
+    memcpy(cs->fields, board->fields, ENGINE_SPAN(board));
+    memcpy(cs->drops, board->drops, ENGINE_WIDTH(board)*sizeof(Field*));
+    cs->area = *area;
+}
+
+static bool cascade_equal( const CascadeState *cs, const Board *board,
+                           const Rect *area )
+{
+    return cs->area.r1 == area->r1 && cs->area.c1 == area->c1 &&
+           cs->area.r2 == area->r2 && cs->area.c2 == area->c2 &&
+           memcmp( cs->drops, board->drops,
+                   ENGINE_WIDTH(board)*sizeof(Field*) ) == 0 &&
+           memcmp(cs->fields, board->fields, ENGINE_SPAN(board)) == 0;
+}
+
+/* Finds scoring rows on the board, and removes them, repeating the process
+   while scoring rows exist. The total score is returned (or MAX_SCORE, if the
+   total score would equal or exceed MAX_SCORE).
+
+   Area is used as the area of interest (which may be only a small part of
+   the board that has changed).
+
+   Since the cascade is deterministic and every iteration scores points, it
+   never ends if the same state (fields, drop list positions and area) occurs
+   twice. Long cascades are checked for such cycles using Brent's algorithm,
+   so infinite scores are detected within a few periods of the cycle.
+*/
+static int board_score(Board *board, Rect *area, UndoLog *log)
+{
+    int total_score, score, iterations, next_save;
+    CascadeState saved;
+
+    iterations = total_score = 0;
+    next_save = 16;
+    while ((score = remove_groups(board, area, log)) > 0)
+    {
+        fill_columns(board, area);
+        total_score += score;
+        if (board->score + total_score >= SCORE_LIMIT) break;
+        if (++iterations == next_save)
+        {
+            cascade_save(&saved, board, area);
+            next_save *= 2;
+        }
+        else
+        if (iterations > 16 && cascade_equal(&saved, board, area))
+        {
+            /* Cycle detected: the cascade never ends */
+            total_score = SCORE_LIMIT;
+            break;
+        }
+        if (iterations == 10000)
+        {
+            /* No cycle found yet; let's assume we're in an infinite loop */
+            total_score = SCORE_LIMIT;
+            break;
+        }
+    }
+    board->score += total_score;
+    if (board->score > SCORE_LIMIT) board->score = SCORE_LIMIT;
+
+    return total_score;
+}
+
+/* Copy the fields of board `src' to board `dst' */
+static void copy_fields(Board *dst, const Board *src)
+{
+    memcpy(dst->fields, src->fields, ENGINE_SPAN(src)*sizeof(Field));
+}
+
+/* Hash the fields of a board (including the border fields in between,
+   which are the same for all boards) in 64-bit words, and the drop list
+   positions */
+static unsigned long long hash_board(const Board *board)
+{
+    const Field *f = board->fields;
+    size_t n, span = ENGINE_SPAN(board);
+    unsigned long long hash = 14695981039346656037ULL, word;
+    int c;
+
+    for (n = 0; n + sizeof(word) <= span; n += sizeof(word))
+    {
+        memcpy(&word, f + n, sizeof(word));
+        HASH_WORD(hash, word);
+    }
+    for ( ; n < span; ++n) HASH_WORD(hash, (unsigned char)f[n]);
+    for (c = 0; c < ENGINE_WIDTH(board); ++c)
+    {
+        HASH_WORD( hash, (unsigned long long)(board->drops[c] -
+                                              board->game->drops_begin[c]) );
+    }
+
+    return hash;
+}
+
+/* Compare the fields and drop list positions of two boards */
+static int equal_boards(const Board *a, const Board *b)
+{
+    return memcmp( a->drops, b->drops,
+                   ENGINE_WIDTH(a)*sizeof(*a->drops) ) == 0 &&
+           memcmp( a->fields, b->fields,
+                   ENGINE_SPAN(a)*sizeof(Field) ) == 0;
+}
+
+#undef remove_groups
+#undef fill_columns
+#undef cascade_save
+#undef cascade_equal
+#undef board_score
+#undef copy_fields
+#undef hash_board
+#undef equal_boards
+
+#undef ENGINE_FLD
+#undef ENGINE_SPAN
+#undef ENGINE_NAME
+#undef ENGINE_WIDTH
+#undef ENGINE_HEIGHT
+#undef ENGINE_STRIDE
@@ -1,64 +1,231 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+/* Maximum number of threads tracked individually; threads beyond this
+   limit share the last slot. */
+#define MAX_THREADS (64)
+
+/* Number of independently locked shards of the pointer table */
+#define NUM_SHARDS  (64)
+
+/* Size of the allocation site table (must be a power of two) */
+#define SITE_TABLE_SIZE (4096)
+
+/* Simple spin lock (tracking operations are short, so this is cheaper than
+   a mutex and does not depend on a threading library) */
+typedef volatile int Lock;
+#define LOCK(lock)      while (__sync_lock_test_and_set(&(lock), 1)) { }
+#define UNLOCK(lock)    __sync_lock_release(&(lock))
+
+/* Statistics per allocation site */
+struct Site
+{
+    const char * volatile file;     /* file name (NULL if slot unused) */
+    int line;                       /* line number */
+    volatile int claimed;           /* set when slot is being claimed */
+    size_t count;                   /* number of allocations */
+    size_t bytes;                   /* total bytes allocated */
+    size_t live;                    /* bytes currently allocated */
+    size_t peak;                    /* maximum of live bytes */
+};
+
+/* Registered pointer */
 struct Ptr
 {
     struct Ptr *next;   /* pointer to next node in linked list */
 
     void *ptr;          /* registered pointer */
     size_t size;        /* allocated size */
-    const char *file;   /* file where the allocation was made */
-    int line;           /* line where the allocation was made */
+    struct Site *site;  /* site where the allocation was made */
+    int thread;         /* index of the allocating thread */
 };
 
-/* Global variables */
+/* Shard of the pointer table: a hash table of linked lists of registered
+   pointers, which grows as required. */
+struct Shard
+{
+    Lock lock;
+    size_t size, num_buckets;
+    struct Ptr **buckets;
+    struct Ptr *free_list;  /* recycled nodes */
+};
 
-/* Hash table containing linked lists of registered pointers */
-#define HT_SIZE (1234567)
-static struct Ptr *ptrs[HT_SIZE];
+/* Statistics per thread (padded to avoid false sharing) */
+struct ThreadStats
+{
+    size_t allocs, frees, bytes;
+    char padding[64 - 3*sizeof(size_t)];
+};
+
+/* Global variables */
+static struct Shard shards[NUM_SHARDS];
+static struct Site sites[SITE_TABLE_SIZE];
+static struct ThreadStats thread_stats[MAX_THREADS];
+static int num_threads;
+static __thread int thread_index = -1;
 
 /* For running the at-exit handler: */
 static int at_exit_registered;
 static FILE *at_exit_fp;
 
 
+static int get_thread_index()
+{
+    if (thread_index < 0)
+    {
+        thread_index = __sync_fetch_and_add(&num_threads, 1);
+        if (thread_index >= MAX_THREADS) thread_index = MAX_THREADS - 1;
+    }
+    return thread_index;
+}
+
+static size_t hash_ptr(const void *ptr)
+{
+    size_t h = (size_t)ptr >> 4;
+    return h ^ (h >> 7) ^ (h >> 17);
+}
+
+/* Find (or create) the entry for an allocation site. Entries are never
+   removed, so lookups do not need to lock the table. */
+static struct Site *get_site(const char *file, int line)
+{
+    size_t i = (hash_ptr(file) + 31*(size_t)line) & (SITE_TABLE_SIZE - 1);
+    size_t probes;
+
+    for (probes = 0; probes < SITE_TABLE_SIZE; ++probes)
+    {
+        struct Site *s = &sites[i];
+        if (s->file == NULL && __sync_bool_compare_and_swap(&s->claimed, 0, 1))
+        {
+            s->line = line;
+            __sync_synchronize();
+            s->file = file;
+            return s;
+        }
+        while (s->file == NULL && s->claimed) { }   /* being claimed */
+        if (s->file == file && s->line == line) return s;
+        i = (i + 1) & (SITE_TABLE_SIZE - 1);
+    }
+
+    fprintf(stderr, "get_site() table full\n");
+    abort();
+}
 
-void add_ptr(void *ptr, size_t size, const char *file, int line)
+static void grow_shard(struct Shard *shard)
 {
-    struct Ptr *p = malloc(sizeof(struct Ptr));
+    size_t n, new_num_buckets;
+    struct Ptr **new_buckets;
 
-    if (p != NULL)
+    new_num_buckets = shard->num_buckets ? 2*shard->num_buckets : 256;
+    new_buckets = calloc(new_num_buckets, sizeof(struct Ptr*));
+
+    if (new_buckets == NULL)
     {
-        size_t i = ((size_t)ptr)%HT_SIZE;
-        p->next = ptrs[i];
-        p->ptr  = ptr;
-        p->size = size;
-        p->file = file;
-        p->line = line;
-        ptrs[i] = p;
+        fprintf(stderr, "grow_shard() allocation failed\n");
+        abort();
+    }
+
+    for (n = 0; n < shard->num_buckets; ++n)
+    {
+        while (shard->buckets[n] != NULL)
+        {
+            struct Ptr *p = shard->buckets[n];
+            size_t i = hash_ptr(p->ptr)/NUM_SHARDS % new_num_buckets;
+            shard->buckets[n] = p->next;
+            p->next = new_buckets[i];
+            new_buckets[i] = p;
+        }
+    }
+    free(shard->buckets);
+    shard->buckets = new_buckets;
+    shard->num_buckets = new_num_buckets;
+}
+
+/* Insert a pointer into the pointer table (without updating statistics) */
+static void insert_ptr(void *ptr, size_t size, struct Site *site)
+{
+    struct Shard *shard = &shards[hash_ptr(ptr)%NUM_SHARDS];
+    struct Ptr *p;
+    size_t i;
+
+    LOCK(shard->lock);
+
+    if ((p = shard->free_list) != NULL)
+    {
+        shard->free_list = p->next;
     }
     else
+    if ((p = malloc(sizeof(struct Ptr))) == NULL)
     {
         fprintf(stderr, "add_ptr() allocation failed\n");
         abort();
     }
+
+    if (shard->size >= shard->num_buckets) grow_shard(shard);
+    i = hash_ptr(ptr)/NUM_SHARDS % shard->num_buckets;
+    p->next   = shard->buckets[i];
+    p->ptr    = ptr;
+    p->size   = size;
+    p->site   = site;
+    p->thread = get_thread_index();
+    shard->buckets[i] = p;
+    shard->size += 1;
+
+    UNLOCK(shard->lock);
 }
 
-int del_ptr(void *ptr)
+static void add_ptr(void *ptr, size_t size, const char *file, int line)
 {
+    struct Site *site = get_site(file, line);
+    struct ThreadStats *ts = &thread_stats[get_thread_index()];
+    size_t live, peak;
+
+    /* Update statistics */
+    __sync_fetch_and_add(&site->count, 1);
+    __sync_fetch_and_add(&site->bytes, size);
+    live = __sync_add_and_fetch(&site->live, size);
+    while ((peak = site->peak) < live)
+    {
+        if (__sync_bool_compare_and_swap(&site->peak, peak, live)) break;
+    }
+    ts->allocs += 1;
+    ts->bytes  += size;
+
+    insert_ptr(ptr, size, site);
+}
+
+/* Remove a registered pointer. If `size' and `site' are not NULL, they
+   receive the size and allocation site of the removed pointer. Returns
+   zero if the pointer was not registered. */
+static int del_ptr(void *ptr, size_t *size, struct Site **site)
+{
+    struct Shard *shard = &shards[hash_ptr(ptr)%NUM_SHARDS];
     struct Ptr **pp;
-    size_t i = ((size_t)ptr)%HT_SIZE;
 
-    for (pp = &ptrs[i]; *pp; pp = &(*pp)->next)
+    LOCK(shard->lock);
+    if (shard->num_buckets > 0)
     {
-        if ((*pp)->ptr == ptr)
+        size_t i = hash_ptr(ptr)/NUM_SHARDS % shard->num_buckets;
+        for (pp = &shard->buckets[i]; *pp; pp = &(*pp)->next)
         {
-            struct Ptr *p = *pp;
-            *pp = (*pp)->next;
-            free(p);
-            return 1;
+            if ((*pp)->ptr == ptr)
+            {
+                struct Ptr *p = *pp;
+                *pp = p->next;
+                p->next = shard->free_list;
+                shard->free_list = p;
+                shard->size -= 1;
+                if (size != NULL) *size = p->size;
+                if (site != NULL) *site = p->site;
+                UNLOCK(shard->lock);
+
+                __sync_fetch_and_sub(&p->site->live, p->size);
+                thread_stats[get_thread_index()].frees += 1;
+                return 1;
+            }
         }
     }
+    UNLOCK(shard->lock);
 
     return 0;
 }
@@ -79,23 +246,33 @@ void *mem_debug_malloc(const char *file, int line, size_t size)
 
 void *mem_debug_realloc(const char *file, int line, void *ptr, size_t size)
 {
-    /* FIXME: if "ptr" is invalid, then the call to realloc is invalid and
-              may crash the application before we have a chance to verify
-              the pointer in del_ptr(); however, we shouldn't del_ptr first,
-              because the pointer remains valid if realloc() failed. */
+    /* The old pointer is unregistered before calling realloc(), since once
+       it has been freed, another thread may allocate the same address and
+       register it. If realloc() fails, the old pointer remains valid, so it
+       is registered again. */
+    size_t old_size = 0;
+    struct Site *old_site = NULL;
+    void *data;
+
+    if (ptr != NULL && !del_ptr(ptr, &old_size, &old_site))
+    {
+        fprintf( stderr, "[%s:%d] invalid pointer passed to realloc(%p, %zd)\n",
+                         file, line, ptr, size );
+    }
 
-    void *data = realloc(ptr, size);
+    data = realloc(ptr, size);
 
     if (data == NULL && size != 0)
     {
         fprintf( stderr, "%s:%d  realloc(%p, %zd) failed\n",
                          file, line, ptr, size );
-    }
-    else
-    if (ptr != NULL && !del_ptr(ptr))
-    {
-        fprintf( stderr, "[%s:%d] invalid pointer passed to realloc(%p, %zd)\n",
-                         file, line, ptr, size );
+        if (old_site != NULL)
+        {
+            /* Undo del_ptr() */
+            __sync_fetch_and_add(&old_site->live, old_size);
+            thread_stats[get_thread_index()].frees -= 1;
+            insert_ptr(ptr, old_size, old_site);
+        }
     }
 
     if (data != NULL) add_ptr(data, size, file, line);
@@ -122,7 +299,7 @@ void mem_debug_free(const char *file, int line, void *ptr)
 {
     if (ptr == NULL) return;
 
-    if (!del_ptr(ptr))
+    if (!del_ptr(ptr, NULL, NULL))
     {
         fprintf( stderr, "[%s:%d] invalid pointer passed to free(%p)\n",
                          file, line, ptr );
@@ -140,24 +317,77 @@ void mem_debug_report(FILE *fp, int enabled)
     }
 
     struct Ptr *p;
-    size_t i, cnt = 0;;
-    for (i = 0; i < HT_SIZE; ++i)
+    size_t i, j, cnt = 0;
+    for (i = 0; i < NUM_SHARDS; ++i)
     {
-        for (p = ptrs[i]; p != NULL; p = p->next)
+        LOCK(shards[i].lock);
+        for (j = 0; j < shards[i].num_buckets; ++j)
         {
-            fprintf(fp, "Pointer %p with size %zd leaked, "
-                        "allocated in file %s at line %d.\n",
-                        p->ptr, p->size, p->file, p->line );
-            ++cnt;
+            for (p = shards[i].buckets[j]; p != NULL; p = p->next)
+            {
+                fprintf(fp, "Pointer %p with size %zd leaked, "
+                            "allocated in file %s at line %d "
+                            "by thread %d.\n",
+                            p->ptr, p->size, p->site->file, p->site->line,
+                            p->thread );
+                ++cnt;
+            }
         }
+        UNLOCK(shards[i].lock);
     }
 
     if (cnt == 0) fprintf(fp, "No memory leaks present!\n");
 }
 
+/* Orders sites by decreasing peak live bytes */
+static int cmp_site_peak(const void *a, const void *b)
+{
+    const struct Site *s = *(struct Site * const *)a;
+    const struct Site *t = *(struct Site * const *)b;
+    return (s->peak < t->peak) - (s->peak > t->peak);
+}
+
+void mem_debug_profile(FILE *fp, int enabled)
+{
+    struct Site *order[SITE_TABLE_SIZE];
+    size_t i, n = 0;
+    int t;
+
+    if (!enabled)
+    {
+        fprintf(fp, "Memory allocation profiling not enabled!\n");
+        return;
+    }
+
+    for (i = 0; i < SITE_TABLE_SIZE; ++i)
+    {
+        if (sites[i].file != NULL) order[n++] = &sites[i];
+    }
+    qsort(order, n, sizeof(*order), cmp_site_peak);
+
+    fprintf( fp, "%-24s %12s %14s %14s %14s\n",
+             "Allocation site", "count", "bytes", "live bytes", "peak bytes" );
+    for (i = 0; i < n; ++i)
+    {
+        char where[256];
+        sprintf(where, "%.200s:%d", order[i]->file, order[i]->line);
+        fprintf( fp, "%-24s %12zd %14zd %14zd %14zd\n", where,
+                 order[i]->count, order[i]->bytes,
+                 order[i]->live, order[i]->peak );
+    }
+
+    for (t = 0; t < num_threads && t < MAX_THREADS; ++t)
+    {
+        fprintf( fp, "Thread %2d: %zd allocations (%zd bytes), %zd frees\n",
+                 t, thread_stats[t].allocs, thread_stats[t].bytes,
+                 thread_stats[t].frees );
+    }
+}
+
 static void report_at_exit_enabled()
 {
     mem_debug_report(at_exit_fp, 1);
+    mem_debug_profile(at_exit_fp, 1);
 }
 
 static void report_at_exit_disabled()
@@ -3,11 +3,12 @@
 
 /* Simple wrappers for C-style allocation functions (malloc, calloc, realloc
    and free) which can be used to detect memory leaks and freeing of invalid
-   or pointers.
+   or pointers, and to profile memory usage per allocation site.
 
-   Not designed for high performance.
-   IMPORTANT: these functions ARE NOT THREAD SAFE!
-              Use only in singlethreaded applications.
+   These functions are thread safe: registered pointers are kept in a table
+   that is split into independently locked shards, and statistics are
+   updated atomically, so they can be used in multithreaded (OpenMP)
+   programs without serializing all allocations.
 */
 
 #include <stdio.h>
@@ -22,7 +23,13 @@ void mem_debug_free(const char *file, int line, void *ptr);
 /* Write a memory leak report to the given file pointer. */
 void mem_debug_report(FILE *fp, int enabled);
 
-/* Report memory leaks to standard error at exit. */
+/* Write a profile of allocations per allocation site (number of allocations,
+   total bytes, currently allocated bytes and peak allocated bytes) and per
+   thread to the given file pointer. */
+void mem_debug_profile(FILE *fp, int enabled);
+
+/* Report memory leaks (and the allocation profile) to standard error at
+   exit. */
 void mem_debug_report_at_exit(FILE *fp, int enabled);
 
 /* The macro's below are used to select whether the C library memory
@@ -36,11 +43,13 @@ void mem_debug_report_at_exit(FILE *fp, int enabled);
 #define free(ptr)           mem_debug_free(__FILE__, __LINE__, ptr)
 
 #define mem_debug_report(fp)            mem_debug_report(fp, 1)
+#define mem_debug_profile(fp)           mem_debug_profile(fp, 1)
 #define mem_debug_report_at_exit(fp)    mem_debug_report_at_exit(fp, 1)
 
 #else
 
 #define mem_debug_report(fp)            mem_debug_report(fp, 0)
+#define mem_debug_profile(fp)           mem_debug_profile(fp, 0)
 #define mem_debug_report_at_exit(fp)    mem_debug_report_at_exit(fp, 0)
 
 #endif
@@ -1,30 +1,64 @@
 #include "Moves.h"
 
+/* Since blocked fields never match a block, the scans below may run onto the
+   border of the board (see Game.h) and need not check bounds: a row of
+   matching blocks always ends before the first border field.
+
+   Validity of candidate moves is checked with precomputed neighbourhoods.
+
+   After swapping, the field moved to position p forms a scoring row only
+   with fields in a radius-2 neighbourhood of p: two fields A1, A2 further
+   away from the other position in the direction of the swap, and two fields
+   on either side perpendicular to it (P1, P2 and Q1, Q2, nearest first).
+   Comparing these six fields with the moved field gives a 6-bit mask (bits
+   0 through 5 for A1, A2, P1, P2, Q1, Q2), which is a match if it contains
+   A1&A2, P1&P2, Q1&Q2 or P1&Q1. MATCH_TABLE has bit m set for each mask m
+   that is a match.
+
+   Neighbours outside the board fall on the blocked border, so they never
+   match and no bounds checks are needed. */
+#define MATCH_TABLE (0xfffff888f8f8f888ULL)
+
+/* Evaluates to the match mask of neighbourhood `nb' against field value f */
+#define MATCH_MASK(fld, nb, f) ( \
+    ((fld)[(nb)[0]] == (f) ? 0x01 : 0) | ((fld)[(nb)[1]] == (f) ? 0x02 : 0) | \
+    ((fld)[(nb)[2]] == (f) ? 0x04 : 0) | ((fld)[(nb)[3]] == (f) ? 0x08 : 0) | \
+    ((fld)[(nb)[4]] == (f) ? 0x10 : 0) | ((fld)[(nb)[5]] == (f) ? 0x20 : 0) )
+
+static bool valid_kernel(const Field *fld, const Candidate *m)
+{
+    int f = fld[m->pos[0]], g = fld[m->pos[1]];
+    if (f == g || f <= 0 || g <= 0) return false;
+
+    return ( (MATCH_TABLE >> MATCH_MASK(fld, m->nb[0], g)) |
+             (MATCH_TABLE >> MATCH_MASK(fld, m->nb[1], f)) ) & 1;
+}
+
 static int scan_left(const Board *b, int r, int c, int f)
 {
     int d = c;
-    while (d > 0 && FLD(b, r, d - 1) == f) --d;
+    while (FLD(b, r, d - 1) == f) --d;
     return c - d;
 }
 
 static int scan_right(const Board *b, int r, int c, int f)
 {
     int d = c;
-    while (d + 1 < WID(b) && FLD(b, r, d + 1) == f) ++d;
+    while (FLD(b, r, d + 1) == f) ++d;
     return d - c;
 }
 
 static int scan_up(const Board *b, int r, int c, int f)
 {
     int s = r;
-    while (s > 0 && FLD(b, s - 1, c) == f) --s;
+    while (FLD(b, s - 1, c) == f) --s;
     return r - s;
 }
 
 static int scan_down(const Board *b, int r, int c, int f)
 {
     int s = r;
-    while (s + 1 < HIG(b) && FLD(b, s + 1, c) == f) ++s;
+    while (FLD(b, s + 1, c) == f) ++s;
     return s - r;
 }
 
@@ -60,10 +94,8 @@ static bool valid_vertical(const Board *b, int r, int c)
 
 bool valid_candidate(const Board *b, int r, int c, bool vert)
 {
-    /* Check if move is out of bounds ((r,c) is assumed to be in bounds) */
-    if (vert ? (r == HIG(b) - 1) : (c == WID(b) - 1)) return false;
-
-    /* Check if fields moved are free */
+    /* Check if fields moved are free (which also excludes moves off the
+       board, since border fields are blocked) */
     int f = FLD(b, r, c), g = FLD(b, r + vert, c + !vert);
     if (f <= 0 || g <= 0) return false;
 
@@ -78,10 +110,114 @@ bool move_valid(const Board *b, int r, int c, bool vert)
                 : valid_horizontal(b, r, c);
 }
 
-bool move_valid_candidate(const Board *b, Candidate *move)
+bool move_valid_candidate(const Board *b, const Candidate *move)
+{
+    if (b->dead_regions >> move->region & 1) return false;
+    return valid_kernel(b->fields, move);
+}
+
+int move_valid_candidates( Board *b, const Candidate *moves, int count,
+                           int *valid )
+{
+    const Field *fld = b->fields;
+    const unsigned dead = b->dead_regions;
+    unsigned live = 0;
+    int n, num_valid = 0;
+
+    for (n = 0; n < count; ++n)
+    {
+        if (dead >> moves[n].region & 1) continue;
+        valid[num_valid] = n;
+        if (valid_kernel(fld, &moves[n]))
+        {
+            live |= 1u << moves[n].region;
+            ++num_valid;
+        }
+    }
+
+    /* Regions without valid moves stay dead, since only moves inside a
+       region can change it */
+    b->dead_regions = ~live;
+
+    return num_valid;
+}
+
+int board_expand( Board *board, const Candidate *moves, int count,
+                  Board **children, int *indices,
+                  unsigned long long *hashes, int *dropped )
+{
+    int valid[MAX_MOVES];
+    int i, j, num_valid, num_children = 0;
+
+    num_valid = move_valid_candidates(board, moves, count, valid);
+    for (i = 0; i < num_valid; ++i)
+    {
+        const Candidate *m = &moves[valid[i]];
+        unsigned long long hash;
+        Board *child;
+
+        child = board_clone(board);
+        if (child == NULL) goto failed;
+        board_move(child, m->r, m->c, m->r + m->vert, m->c + !m->vert, 1);
+
+        /* Compare with siblings by hash first */
+        hash = board_hash(child);
+        for (j = 0; j < num_children; ++j)
+        {
+            if (hashes[j] == hash && board_equal(children[j], child)) break;
+        }
+        if (j < num_children)
+        {
+            if (child->score > children[j]->score)
+            {
+                board_free(children[j]);
+                children[j] = child;
+                indices[j] = valid[i];
+            }
+            else
+            {
+                board_free(child);
+            }
+            if (dropped != NULL) ++*dropped;
+            continue;
+        }
+        children[num_children] = child;
+        indices[num_children] = valid[i];
+        hashes[num_children] = hash;
+        ++num_children;
+    }
+
+    return num_children;
+
+failed:
+    while (num_children > 0) board_free(children[--num_children]);
+    return -1;
+}
+
+/* Returns the offset of field (r,c), which may lie on the border */
+static short offset(const Board *b, int r, int c)
+{
+    return &FLD(b, r, c) - b->fields;
+}
+
+/* Precompute the neighbourhoods of a candidate move (see above) */
+static void init_candidate(const Board *b, Candidate *m)
 {
-    return move->vert ? valid_vertical(b, move->r, move->c)
-                      : valid_horizontal(b, move->r, move->c);
+    int p, dr = m->vert, dc = !m->vert;
+
+    m->region = b->game->region[(int)m->c];
+    for (p = 0; p < 2; ++p)
+    {
+        int r = m->r + p*dr, c = m->c + p*dc;
+        int s = p ? 1 : -1;         /* direction away from other position */
+        m->pos[p]   = offset(b, r, c);
+        m->nb[p][0] = offset(b, r + 1*s*dr, c + 1*s*dc);
+        m->nb[p][1] = offset(b, r + 2*s*dr, c + 2*s*dc);
+        m->nb[p][2] = offset(b, r - 1*dc, c - 1*dr);
+        m->nb[p][3] = offset(b, r - 2*dc, c - 2*dr);
+        m->nb[p][4] = offset(b, r + 1*dc, c + 1*dr);
+        m->nb[p][5] = offset(b, r + 2*dc, c + 2*dr);
+    }
 }
 
 int move_generate_candidates(const Board *b, Candidate *moves)
@@ -98,6 +234,7 @@ int move_generate_candidates(const Board *b, Candidate *moves)
                     moves[n].r = r;
                     moves[n].c = c;
                     moves[n].vert = v;
+                    init_candidate(b, &moves[n]);
                     n += 1;
                 }
             }
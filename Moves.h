@@ -8,11 +8,19 @@
 
 /* Models a move, consisting of two adjacent fields to be swapped.
    If vert == false, then these fields are (r,c) and (r,c+1);
-   if vert == true,  then these fields are (r,c) and (r+1,c). */
+   if vert == true,  then these fields are (r,c) and (r+1,c).
+
+   For candidate moves generated by move_generate_candidates(), the offsets
+   of the swapped fields and of their neighbourhoods in the board's field
+   array are precomputed too, so validity can be checked without any bounds
+   checks (see Moves.c). */
 typedef struct Candidate
 {
     char r, c;
     bool vert;
+    unsigned char region;   /* region of the board containing the move */
+    short pos[2];       /* offsets of the swapped fields */
+    short nb[2][6];     /* offsets of neighbouring fields of each position */
 } Candidate;
 
 /* Returns whether the given move is valid.
@@ -26,8 +34,38 @@ bool move_valid(const Board *b, int r, int c, bool vert);
    (A candidate move is a move which has already been verified to stay inside
     the grid, and not operate on a blocked cell; therefore, the only thing
     left to check is whether executing the move results in a positive score.)
+   Moves in regions marked dead in the board are not valid.
 */
-bool move_valid_candidate(const Board *b, Candidate *move);
+bool move_valid_candidate(const Board *b, const Candidate *move);
+
+/* Checks all `count' candidate moves generated for the game at once, and
+   stores the indices of the valid ones in `valid' (which must have room for
+   `count' elements). Returns the number of valid moves found.
+
+   Candidates in regions marked dead in the board are skipped, and regions
+   found without valid moves are marked dead, since no move elsewhere can
+   change them. */
+int move_valid_candidates( Board *b, const Candidate *moves, int count,
+                           int *valid );
+
+/* Expands a board: performs each valid move among the candidates on a copy
+   of the board (with trace information), checking validity of all
+   candidates at once with move_valid_candidates() first, so `moves' must be
+   the full list of candidates generated for the game.
+
+   Different moves often lead to the same state (for example, when two swaps
+   clear the same row), so children are compared with their siblings, and
+   duplicates are dropped (keeping the one with the highest score). The
+   number of children dropped is added to `dropped' (if not NULL).
+
+   For each remaining child, in candidate order, the board is stored in
+   `children', the index of its move in `indices' and its hash (see
+   board_hash()) in `hashes'; these arrays must have room for `count'
+   elements. Returns the number of children, or -1 if memory allocation
+   failed (in which case no children are returned). */
+int board_expand( Board *board, const Candidate *moves, int count,
+                  Board **children, int *indices,
+                  unsigned long long *hashes, int *dropped );
 
 /* Generates a list of candidate moves.
    `moves` must be an array of size MAX_MOVES.
@@ -0,0 +1,255 @@
+#include "MultiQueue.h"
+#include "MemDebug.h"
+#include <assert.h>
+#include <string.h>
+
+/* Simple spin lock (queue operations are short, so this is cheaper than
+   a mutex and does not depend on a threading library) */
+#define LOCK(lock)      while (__sync_lock_test_and_set(&(lock), 1)) { }
+#define UNLOCK(lock)    __sync_lock_release(&(lock))
+
+/* Per-thread random number generator state for selecting shards */
+static __thread unsigned rng_state = 0;
+static unsigned rng_seed = 0;
+
+/* Returns a random shard index (xorshift32 generator) */
+static int random_shard(const MultiQueue *mq)
+{
+    unsigned x = rng_state;
+    if (x == 0) x = 2463534242U + 7919U*__sync_add_and_fetch(&rng_seed, 1);
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return (int)(x%mq->num_shards);
+}
+
+/* Update the unlocked copies of the shard's state; shard must be locked. */
+static void shard_update(MultiQueueShard *shard)
+{
+    shard->size = pq_size(shard->pq);
+    if (shard->size > 0) shard->max_prio = pq_max_prio(shard->pq);
+}
+
+MultiQueue *mq_create(int num_shards, size_t capacity)
+{
+    MultiQueue *mq;
+    int n;
+
+    assert(num_shards > 0);
+    mq = malloc(sizeof(MultiQueue));
+    if (mq == NULL) return NULL;
+    mq->shards = malloc(num_shards*sizeof(MultiQueueShard));
+    if (mq->shards == NULL)
+    {
+        free(mq);
+        return NULL;
+    }
+    memset(mq->shards, 0, num_shards*sizeof(MultiQueueShard));
+    mq->num_shards = num_shards;
+    mq->capacity   = capacity;
+    mq->size       = 0;
+    for (n = 0; n < num_shards; ++n)
+    {
+        mq->shards[n].pq = pq_create(capacity/num_shards + 1);
+        if (mq->shards[n].pq == NULL)
+        {
+            mq_destroy(mq);
+            return NULL;
+        }
+    }
+
+    return mq;
+}
+
+void mq_destroy(MultiQueue *mq)
+{
+    int n;
+
+    for (n = 0; n < mq->num_shards; ++n)
+    {
+        if (mq->shards[n].pq != NULL) pq_destroy(mq->shards[n].pq);
+    }
+    free(mq->shards);
+    free(mq);
+}
+
+void mq_set_capacity(MultiQueue *mq, size_t capacity)
+{
+    assert(capacity >= mq->size);
+    mq->capacity = capacity;
+}
+
+/* Add an element to a locked shard, growing it if necessary. Returns zero
+   if memory allocation fails. */
+static int shard_push(MultiQueueShard *shard, int prio, void *data)
+{
+    if ( pq_full(shard->pq) &&
+         !pq_resize(shard->pq, 2*pq_capacity(shard->pq)) ) return 0;
+    pq_push(shard->pq, prio, data);
+    shard_update(shard);
+    return 1;
+}
+
+void *mq_push(MultiQueue *mq, int prio, void *data, int evict)
+{
+    MultiQueueShard *shard;
+    void *old_data;
+    int n, i;
+
+    if (!evict)
+    {
+        /* Reserve room for the new element */
+        if (__sync_fetch_and_add(&mq->size, 1) < mq->capacity)
+        {
+            shard = &mq->shards[random_shard(mq)];
+            LOCK(shard->lock);
+            n = shard_push(shard, prio, data);
+            UNLOCK(shard->lock);
+            if (n) return NULL;
+            __sync_fetch_and_sub(&mq->size, 1);
+            return data;
+        }
+        __sync_fetch_and_sub(&mq->size, 1);
+    }
+
+    /* Replace the minimum element of the first non-empty shard, starting
+       from a random shard */
+    i = random_shard(mq);
+    for (n = 0; n < mq->num_shards; ++n)
+    {
+        shard = &mq->shards[(i + n)%mq->num_shards];
+        if (shard->size == 0) continue;
+        LOCK(shard->lock);
+        if (!pq_empty(shard->pq))
+        {
+            if (prio <= pq_min_prio(shard->pq))
+            {
+                old_data = data;
+            }
+            else
+            {
+                old_data = pq_pop_min(shard->pq);
+                pq_push(shard->pq, prio, data);
+                shard_update(shard);
+            }
+            UNLOCK(shard->lock);
+            return old_data;
+        }
+        UNLOCK(shard->lock);
+    }
+
+    /* All shards are empty: add the element anyway */
+    shard = &mq->shards[i];
+    LOCK(shard->lock);
+    n = shard_push(shard, prio, data);
+    UNLOCK(shard->lock);
+    if (!n) return data;
+    __sync_fetch_and_add(&mq->size, 1);
+    return NULL;
+}
+
+void *mq_pop_max(MultiQueue *mq, int *prio)
+{
+    MultiQueueShard *shard, *other;
+    void *data;
+    int n, i;
+
+    while (mq->size > 0)
+    {
+        /* Sample two shards and pick the one with the higher maximum */
+        shard = &mq->shards[random_shard(mq)];
+        other = &mq->shards[random_shard(mq)];
+        if ( shard->size == 0 ||
+             (other->size > 0 && other->max_prio > shard->max_prio) )
+        {
+            shard = other;
+        }
+        if (shard->size == 0)
+        {
+            /* Both empty: take the first non-empty shard instead */
+            i = random_shard(mq);
+            for (n = 0; n < mq->num_shards; ++n)
+            {
+                shard = &mq->shards[(i + n)%mq->num_shards];
+                if (shard->size > 0) break;
+            }
+            if (shard->size == 0) continue;
+        }
+
+        LOCK(shard->lock);
+        if (pq_empty(shard->pq))
+        {
+            /* Emptied by another thread in the meantime */
+            UNLOCK(shard->lock);
+            continue;
+        }
+        if (prio != NULL) *prio = pq_max_prio(shard->pq);
+        data = pq_pop_max(shard->pq);
+        shard_update(shard);
+        UNLOCK(shard->lock);
+        __sync_fetch_and_sub(&mq->size, 1);
+        return data;
+    }
+
+    return NULL;
+}
+
+/* Return the shard containing the minimum element, or NULL if empty. */
+static MultiQueueShard *min_shard(MultiQueue *mq)
+{
+    MultiQueueShard *best = NULL;
+    int n;
+
+    for (n = 0; n < mq->num_shards; ++n)
+    {
+        MultiQueueShard *shard = &mq->shards[n];
+        if ( !pq_empty(shard->pq) && (best == NULL ||
+             pq_min_prio(shard->pq) < pq_min_prio(best->pq)) )
+        {
+            best = shard;
+        }
+    }
+
+    return best;
+}
+
+void *mq_pop_min(MultiQueue *mq, int *prio)
+{
+    MultiQueueShard *shard = min_shard(mq);
+    void *data;
+
+    if (shard == NULL) return NULL;
+    if (prio != NULL) *prio = pq_min_prio(shard->pq);
+    data = pq_pop_min(shard->pq);
+    shard_update(shard);
+    --mq->size;
+    return data;
+}
+
+int mq_min_prio(MultiQueue *mq)
+{
+    MultiQueueShard *shard = min_shard(mq);
+    assert(shard != NULL);
+    return pq_min_prio(shard->pq);
+}
+
+PriorityQueue *mq_collect(MultiQueue *mq)
+{
+    PriorityQueue *pq;
+    size_t i;
+    int n;
+
+    pq = pq_create(mq->size > mq->capacity ? mq->size : mq->capacity);
+    if (pq == NULL) return NULL;
+    for (n = 0; n < mq->num_shards; ++n)
+    {
+        PriorityQueue *shard_pq = mq->shards[n].pq;
+        for (i = 0; i < pq_size(shard_pq); ++i)
+        {
+            pq_push(pq, pq_elem_prio(shard_pq, i), pq_elem_data(shard_pq, i));
+        }
+    }
+
+    return pq;
+}
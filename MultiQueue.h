@@ -0,0 +1,90 @@
+#ifndef MULTI_QUEUE_H_INCLUDED
+#define MULTI_QUEUE_H_INCLUDED
+
+/* A concurrent, relaxed priority queue (a "MultiQueue") that stores pointers
+   only. Elements are distributed over several independently locked
+   PriorityQueue shards: new elements are added to a random shard, and the
+   maximum is taken from the better of two randomly sampled shards, so the
+   element returned is usually, but not always, the global maximum.
+
+   The total number of elements is bounded by a single capacity, regardless
+   of how elements are distributed over shards.
+*/
+
+#include "PriorityQueue.h"
+
+/* Shard of a multi-queue; should not be accessed directly. */
+typedef struct MultiQueueShard
+{
+    PriorityQueue   *pq;
+    volatile int    lock;
+    volatile int    max_prio;   /* priority of maximum (if size > 0) */
+    volatile size_t size;       /* copy of pq_size(pq), readable unlocked */
+    char            padding[64 - sizeof(PriorityQueue*) - 2*sizeof(int) -
+                            sizeof(size_t)];
+} MultiQueueShard;
+
+/* Multi-queue implementation structure; should not be accessed directly. */
+typedef struct MultiQueue
+{
+    int             num_shards;
+    MultiQueueShard *shards;
+    size_t          capacity;   /* maximum total size */
+    volatile size_t size;       /* total size */
+} MultiQueue;
+
+
+/* Create a multi-queue with the given number of shards and total capacity.
+   Returns NULL if memory allocation fails. */
+MultiQueue *mq_create(int num_shards, size_t capacity);
+
+/* Destroy a multi-queue, freeing all allocated resources. */
+void mq_destroy(MultiQueue *mq);
+
+/* Return the capacity (maximum total size) of the multi-queue. */
+#define mq_capacity(mq) ((mq)->capacity)
+
+/* Return the total size of the multi-queue. */
+#define mq_size(mq) ((mq)->size)
+
+/* Return whether the multi-queue is empty. */
+#define mq_empty(mq) (mq_size(mq) == 0)
+
+/* Change the capacity of the multi-queue. The new capacity must not be less
+   than the current size (the caller is responsible for removing excess
+   elements first). This only changes the limit and allocates no memory;
+   shards are grown later, by mq_push(), as elements are added. */
+void mq_set_capacity(MultiQueue *mq, size_t capacity);
+
+/* Add an element to a random shard. Safe to call concurrently.
+
+   If the queue is full, or `evict' is non-zero, the minimum element of a
+   shard is removed to make room, unless the new element has a lower
+   priority, in which case the new element is not added. The element that
+   was not kept (or NULL, if the element was added without removing another)
+   is returned. If memory allocation fails, the new element is returned too.
+*/
+void *mq_push(MultiQueue *mq, int prio, void *data, int evict);
+
+/* Remove the maximum element of the better of two random shards and return
+   it, or NULL if the queue is empty. If `prio' is not NULL, the priority of
+   the element is stored there. Safe to call concurrently. */
+void *mq_pop_max(MultiQueue *mq, int *prio);
+
+/* Remove the minimum element of the entire queue and return it, or NULL if
+   the queue is empty. Must not be called concurrently with other
+   operations. */
+void *mq_pop_min(MultiQueue *mq, int *prio);
+
+/* Return the priority of the minimum element of the entire queue, which
+   must not be empty. Must not be called concurrently with other
+   operations. */
+int mq_min_prio(MultiQueue *mq);
+
+/* Create a priority queue containing all elements of the multi-queue (the
+   elements are shared between both queues). Returns NULL if memory
+   allocation fails. Must not be called concurrently with other
+   operations. */
+PriorityQueue *mq_collect(MultiQueue *mq);
+
+#endif /* ndef MULTI_QUEUE_H_INCLUDED */
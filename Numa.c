@@ -0,0 +1,93 @@
+#define _GNU_SOURCE     /* sched_setaffinity() and CPU_SET() */
+#include "Numa.h"
+#include <sched.h>
+#include <stdio.h>
+
+/* Maximum number of NUMA nodes considered */
+#define MAX_NODES (64)
+
+/* Read the list of CPUs of a NUMA node (in the kernel's cpulist format,
+   e.g. "0-3,8-11") into `cpus'. Returns the number of CPUs found. */
+static int read_node_cpus(int node, cpu_set_t *cpus)
+{
+    char path[64];
+    FILE *fp;
+    int first, last, count = 0;
+
+    sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+    if ((fp = fopen(path, "rt")) == NULL) return 0;
+    CPU_ZERO(cpus);
+    while (fscanf(fp, "%d", &first) == 1)
+    {
+        last = first;
+        if (fscanf(fp, "-%d", &last) < 0) break;
+        for ( ; first <= last && first < CPU_SETSIZE; ++first)
+        {
+            CPU_SET(first, cpus);
+            ++count;
+        }
+        if (fgetc(fp) != ',') break;
+    }
+    fclose(fp);
+
+    return count;
+}
+
+int numa_bind_process(int node)
+{
+    cpu_set_t cpus;
+    int count;
+
+    if (node < 0 || (count = read_node_cpus(node, &cpus)) == 0) return 0;
+    return sched_setaffinity(0, sizeof(cpus), &cpus) == 0 ? count : 0;
+}
+
+int numa_num_nodes()
+{
+    cpu_set_t cpus;
+    int node;
+
+    for (node = 0; node < MAX_NODES; ++node)
+    {
+        if (read_node_cpus(node, &cpus) == 0) break;
+    }
+    return node > 0 ? node : 1;
+}
+
+int numa_pin_thread(int index)
+{
+    cpu_set_t allowed, node_cpus, cpus;
+    int num_nodes = numa_num_nodes(), count = 0, node, cpu, n;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return -1;
+    count = CPU_COUNT(&allowed);
+    if (count == 0) return -1;
+    index %= count;
+
+    /* Find the index-th allowed CPU, enumerating CPUs node by node */
+    for (node = 0; node < num_nodes; ++node)
+    {
+        if (read_node_cpus(node, &node_cpus) == 0)
+        {
+            /* Topology unknown: treat all CPUs as a single node */
+            CPU_ZERO(&node_cpus);
+            for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) CPU_SET(cpu, &node_cpus);
+        }
+        for (cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (!CPU_ISSET(cpu, &allowed) || !CPU_ISSET(cpu, &node_cpus))
+            {
+                continue;
+            }
+            if (index-- == 0)
+            {
+                CPU_ZERO(&cpus);
+                CPU_SET(cpu, &cpus);
+                n = sched_setaffinity(0, sizeof(cpus), &cpus);
+                return n == 0 ? node : -1;
+            }
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,21 @@
+#ifndef NUMA_H_INCLUDED
+#define NUMA_H_INCLUDED
+
+/* Minimal NUMA support for Linux, based on the node topology described in
+   /sys/devices/system/node (so no NUMA library is required). */
+
+/* Restrict the calling process to the CPUs of the given NUMA node. Returns
+   the number of CPUs of the node, or zero if the node does not exist or the
+   affinity could not be set. */
+int numa_bind_process(int node);
+
+/* Return the number of NUMA nodes (1 if the topology is unknown). */
+int numa_num_nodes();
+
+/* Pin the calling thread to one of the CPUs the process may run on; threads
+   with consecutive indices are placed on the same node as far as possible,
+   so threads that share data also share caches. Returns the NUMA node of the
+   selected CPU, or -1 if the thread could not be pinned. */
+int numa_pin_thread(int index);
+
+#endif /* ndef NUMA_H_INCLUDED */
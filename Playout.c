@@ -0,0 +1,122 @@
+#include "Playout.h"
+#include "MemDebug.h"
+#include "Rollout.h"
+#include "Util.h"
+#include <string.h>
+
+PlayoutEngine *playout_create( Game *game, const Candidate *cands,
+                               int num_cands, unsigned seed )
+{
+    PlayoutEngine *pe;
+
+    pe = malloc(sizeof(PlayoutEngine));
+    if (pe == NULL) return NULL;
+    memset(pe, 0, sizeof(PlayoutEngine));
+    pe->game        = game;
+    pe->cands       = cands;
+    pe->num_cands   = num_cands;
+    pe->rng         = seed;
+    pe->board       = board_clone(game->initial);
+    pe->undo        = undo_create();
+    pe->trace       = malloc(MOVE_LIMIT*sizeof(unsigned short));
+    pe->best_trace  = malloc(MOVE_LIMIT*sizeof(unsigned short));
+    pe->best_score  = game->initial->score;
+    if ( pe->board == NULL || pe->undo == NULL ||
+         pe->trace == NULL || pe->best_trace == NULL )
+    {
+        playout_destroy(pe);
+        return NULL;
+    }
+
+    return pe;
+}
+
+void playout_destroy(PlayoutEngine *pe)
+{
+    if (pe == NULL) return;
+    undo_destroy(pe->undo);
+    board_free(pe->board);
+    free(pe->trace);
+    free(pe->best_trace);
+    free(pe);
+}
+
+/* Record the current playout if it is better than the best one so far. */
+static void update_best(PlayoutEngine *pe)
+{
+    Board *b = pe->board;
+    if ( b->moves > pe->best_length ||
+         (b->moves == pe->best_length && b->score > pe->best_score) )
+    {
+        memcpy(pe->best_trace, pe->trace, b->moves*sizeof(unsigned short));
+        pe->best_length = b->moves;
+        pe->best_score  = b->score;
+    }
+}
+
+int playout_run(PlayoutEngine *pe, int max_retries, long long deadline)
+{
+    Board *b = pe->board;
+    UndoLog *undo = pe->undo;
+    int retries = 0, steps = 0;
+    RolloutPolicy policy = ROLLOUT_GREEDY;
+
+    board_copy(b, pe->game->initial);
+    undo_forget(undo, 0);
+    for (;;)
+    {
+        const Candidate *cand;
+
+        if (b->moves >= MOVE_LIMIT || b->score >= SCORE_LIMIT) break;
+        if ( deadline != 0 && ++steps%PLAYOUT_CLOCK_INTERVAL == 0 &&
+             util_ustime() >= deadline ) break;
+
+        cand = rollout_select(b, pe->cands, pe->num_cands, policy, &pe->rng);
+        if (cand == NULL)
+        {
+            /* Dead end: undo a few moves, and continue with a random move
+               from there. */
+            int n;
+
+            update_best(pe);
+            if (retries++ == max_retries || undo->count == 0) break;
+            n = 1 + rollout_random(&pe->rng)%PLAYOUT_BACKTRACK;
+            while (n-- > 0 && undo->count > 0) board_undo(b, undo);
+            policy = ROLLOUT_RANDOM;
+            continue;
+        }
+
+        /* Only the last few moves can be undone, so keep the log small */
+        if (undo->count == 2*PLAYOUT_BACKTRACK)
+        {
+            undo_forget(undo, PLAYOUT_BACKTRACK);
+        }
+
+        pe->trace[b->moves] = (unsigned short)(cand - pe->cands);
+        if ( board_move_logged( b, cand->r, cand->c,
+                                cand->r + cand->vert, cand->c + !cand->vert,
+                                0, undo ) < 0 ) break;  /* out of memory */
+        policy = rollout_random(&pe->rng)%16 == 0 ? ROLLOUT_RANDOM
+                                                   : ROLLOUT_GREEDY;
+    }
+    update_best(pe);
+
+    return b->moves;
+}
+
+Board *playout_best_board(PlayoutEngine *pe)
+{
+    Board *board;
+    int n;
+
+    board = board_clone(pe->game->initial);
+    if (board == NULL) return NULL;
+    for (n = 0; n < pe->best_length; ++n)
+    {
+        const Candidate *cand = &pe->cands[pe->best_trace[n]];
+        board_move( board, cand->r, cand->c,
+                    cand->r + cand->vert, cand->c + !cand->vert, 1 );
+    }
+
+    return board;
+}
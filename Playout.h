@@ -0,0 +1,57 @@
+#ifndef PLAYOUT_H_INCLUDED
+#define PLAYOUT_H_INCLUDED
+
+/* Playout engine for finding feasible solutions quickly.
+
+   A playout plays a single game from the initial board on one preallocated
+   board, selecting moves with a cheap policy (mostly the topmost valid move)
+   and recording only the indices of the candidate moves played in a flat
+   array. When the game ends prematurely, the engine undoes the last few
+   moves in place and continues with different (random) choices. Apart from
+   the undo log reaching its working size, no memory is allocated after the
+   engine has been created.
+*/
+
+#include "Game.h"
+#include "Moves.h"
+
+/* Maximum number of moves undone when backtracking */
+#define PLAYOUT_BACKTRACK (64)
+
+/* Number of moves played between checks of the deadline */
+#define PLAYOUT_CLOCK_INTERVAL (1024)
+
+typedef struct PlayoutEngine
+{
+    Game            *game;
+    const Candidate *cands;         /* candidate moves */
+    int             num_cands;
+    Board           *board;         /* working board */
+    UndoLog         *undo;          /* undo log for backtracking */
+    unsigned short  *trace;         /* candidate indices of moves played */
+    unsigned short  *best_trace;    /* trace of longest playout */
+    int             best_length;    /* length of best_trace */
+    int             best_score;     /* score at the end of best_trace */
+    unsigned        rng;            /* random number generator state */
+} PlayoutEngine;
+
+/* Create a playout engine for the given game and candidate moves (which must
+   remain valid while the engine is used), or return NULL if memory
+   allocation fails. `seed' must be non-zero. */
+PlayoutEngine *playout_create( Game *game, const Candidate *cands,
+                               int num_cands, unsigned seed );
+
+/* Destroy a playout engine. */
+void playout_destroy(PlayoutEngine *pe);
+
+/* Play a game from the initial board, backtracking at most `max_retries'
+   times, and stop early when util_ustime() reaches `deadline' (if non-zero).
+   Returns the number of moves played; the best playout found so far is kept
+   in best_trace. */
+int playout_run(PlayoutEngine *pe, int max_retries, long long deadline);
+
+/* Replay the best playout found so far (with trace information) and return
+   the resulting board, or NULL if memory allocation fails. */
+Board *playout_best_board(PlayoutEngine *pe);
+
+#endif /* ndef PLAYOUT_H_INCLUDED */
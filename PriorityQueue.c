@@ -142,6 +142,47 @@ void pq_destroy(PriorityQueue *pq)
     free(pq);
 }
 
+int pq_resize(PriorityQueue *pq, size_t capacity)
+{
+    HeapNode *min_heap = NULL, *max_heap = NULL;
+    size_t n;
+
+    assert(pq->size <= capacity);
+
+    /* Allocate new heaps (capacity may be zero, so allocate at least one) */
+    min_heap = malloc((capacity > 0 ? capacity : 1)*sizeof(HeapNode));
+    if (min_heap == NULL) goto failed;
+    max_heap = malloc((capacity > 0 ? capacity : 1)*sizeof(HeapNode));
+    if (max_heap == NULL) goto failed;
+
+    /* Copy elements, translating cross references to the new heaps */
+    for (n = 0; n < pq->size; ++n)
+    {
+        min_heap[n].prio  = pq->min_heap[n].prio;
+        min_heap[n].data  = pq->min_heap[n].data;
+        min_heap[n].other = max_heap + (pq->min_heap[n].other - pq->max_heap);
+        max_heap[n].prio  = pq->max_heap[n].prio;
+        max_heap[n].data  = pq->max_heap[n].data;
+        max_heap[n].other = min_heap + (pq->max_heap[n].other - pq->min_heap);
+    }
+
+    free(pq->min_heap);
+    free(pq->max_heap);
+    pq->capacity = capacity;
+    pq->min_heap = min_heap;
+    pq->max_heap = max_heap;
+
+    heap_check(pq->min_heap, pq->size);
+    heap_check(pq->max_heap, pq->size);
+
+    return 1;
+
+failed:
+    free(min_heap);
+    free(max_heap);
+    return 0;
+}
+
 void *pq_pop_min(PriorityQueue *pq)
 {
     assert(pq->size > 0);
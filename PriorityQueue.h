@@ -30,6 +30,13 @@ PriorityQueue *pq_create(size_t capacity);
 /* Destroy a priority queue, freeing all allocated resources. */
 void pq_destroy(PriorityQueue *pq);
 
+/* Change the capacity of a priority queue. The new capacity must not be
+   less than the current size of the queue (the caller is responsible for
+   removing excess elements first).
+   Returns zero if memory allocation fails, in which case the queue is left
+   unchanged, or non-zero on success. */
+int pq_resize(PriorityQueue *pq, size_t capacity);
+
 /* Return the capacity (maximum size) of the priority queue. */
 #define pq_capacity(pq) ((pq)->capacity)
 
@@ -50,6 +57,11 @@ void pq_destroy(PriorityQueue *pq);
 #define pq_min_prio(pq) (+(pq)->min_heap[0].prio)
 #define pq_max_prio(pq) (-(pq)->max_heap[0].prio)
 
+/* Return the data/priority of the i-th element (0 <= i < size) in the queue,
+   in unspecified order; useful for iterating over all elements. */
+#define pq_elem_data(pq, i) ((pq)->min_heap[i].data)
+#define pq_elem_prio(pq, i) (+(pq)->min_heap[i].prio)
+
 /* Remove the minimum/maximum element from the queue and return it */
 void *pq_pop_min(PriorityQueue *pq);
 void *pq_pop_max(PriorityQueue *pq);
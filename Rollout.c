@@ -0,0 +1,66 @@
+#include "Rollout.h"
+
+unsigned rollout_random(unsigned *state)
+{
+    /* 32-bit xorshift generator */
+    unsigned x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+const Candidate *rollout_select( const Board *board,
+                                 const Candidate *cands, int num_cands,
+                                 RolloutPolicy policy, unsigned *rng )
+{
+    const Candidate *best = NULL;
+    int n, i;
+
+    if (num_cands == 0) return NULL;
+    i = rollout_random(rng)%num_cands;
+
+    /* Scan candidates starting from a random position */
+    for (n = 0; n < num_cands; ++n)
+    {
+        const Candidate *cand = &cands[(i + n)%num_cands];
+        if (best != NULL && cand->r >= best->r) continue;
+        if (!move_valid_candidate(board, cand)) continue;
+        best = cand;
+        if (policy == ROLLOUT_RANDOM || best->r == 0) break;
+    }
+
+    return best;
+}
+
+int rollout_evaluate( const Board *board, Board *scratch,
+                      const Candidate *cands, int num_cands,
+                      int count, int depth, RolloutPolicy policy,
+                      unsigned *rng,
+                      int (*eval)(const Board *, const Candidate *),
+                      const Candidate *move )
+{
+    long long total = 0;
+    int n, d;
+
+    if (count <= 0 || num_cands == 0) return eval(board, move);
+
+    for (n = 0; n < count; ++n)
+    {
+        board_copy(scratch, board);
+        for (d = 0; d < depth; ++d)
+        {
+            const Candidate *cand;
+
+            if (scratch->moves >= MOVE_LIMIT) break;
+            if (scratch->score >= SCORE_LIMIT) break;
+            cand = rollout_select(scratch, cands, num_cands, policy, rng);
+            if (cand == NULL) break;
+            board_move( scratch, cand->r, cand->c,
+                        cand->r + cand->vert, cand->c + !cand->vert, 0 );
+        }
+        total += eval(scratch, move);
+    }
+
+    return (int)(total/count);
+}
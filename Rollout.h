@@ -0,0 +1,41 @@
+#ifndef ROLLOUT_H_INCLUDED
+#define ROLLOUT_H_INCLUDED
+
+/* Monte Carlo evaluation of boards: a number of fast continuations (without
+   trace information) is played from a board, and the boards at the end of
+   these rollouts are evaluated instead of the board itself. This rewards
+   boards that lead to long-surviving or high-scoring lines of play. */
+
+#include "Game.h"
+#include "Moves.h"
+
+/* Policy used to select moves during rollouts */
+typedef enum RolloutPolicy
+{
+    ROLLOUT_RANDOM,     /* random valid move */
+    ROLLOUT_GREEDY      /* topmost valid move (disturbs the fewest blocks) */
+} RolloutPolicy;
+
+/* Return a pseudo-random number and update the generator state (which must
+   be non-zero). Each thread should use its own state. */
+unsigned rollout_random(unsigned *state);
+
+/* Select a valid move from the given candidates according to the policy, or
+   return NULL if none of the candidates is valid (or there are none). */
+const Candidate *rollout_select( const Board *board,
+                                 const Candidate *cands, int num_cands,
+                                 RolloutPolicy policy, unsigned *rng );
+
+/* Play `count' rollouts of at most `depth' moves from `board', selecting
+   moves from the given candidates, and return the average value of
+   `eval' (called with `move' as its second argument) for the final boards.
+   `scratch' must be a board of the same game without trace information;
+   it is overwritten. */
+int rollout_evaluate( const Board *board, Board *scratch,
+                      const Candidate *cands, int num_cands,
+                      int count, int depth, RolloutPolicy policy,
+                      unsigned *rng,
+                      int (*eval)(const Board *, const Candidate *),
+                      const Candidate *move );
+
+#endif /* ndef ROLLOUT_H_INCLUDED */
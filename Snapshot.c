@@ -0,0 +1,327 @@
+#include "Snapshot.h"
+#include "MemDebug.h"
+#include "Util.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC      (0x53534a42UL)  /* "BJSS" */
+#define SNAPSHOT_VERSION    (1)
+#define NO_MORE_MOVES       (0xffffffffUL)  /* terminates list of moves */
+
+/* Hash table mapping moves to identifiers (1-based; 0 is used for NULL) */
+typedef struct MoveMap
+{
+    size_t          size, capacity;
+    Move            **keys;
+    unsigned long   *ids;
+} MoveMap;
+
+static size_t move_hash(const Move *move, size_t capacity)
+{
+    return (size_t)(((unsigned long)(size_t)move >> 4)*2654435761UL) &
+           (capacity - 1);
+}
+
+/* Return a pointer to the slot for the given move */
+static size_t move_map_find(const MoveMap *map, const Move *move)
+{
+    size_t i = move_hash(move, map->capacity);
+    while (map->keys[i] != NULL && map->keys[i] != move)
+    {
+        i = (i + 1) & (map->capacity - 1);
+    }
+    return i;
+}
+
+static unsigned long move_map_get(const MoveMap *map, const Move *move)
+{
+    size_t i;
+    if (move == NULL || map->size == 0) return 0;
+    i = move_map_find(map, move);
+    return map->keys[i] == NULL ? 0 : map->ids[i];
+}
+
+static int move_map_put(MoveMap *map, Move *move, unsigned long id)
+{
+    size_t i;
+
+    if (2*(map->size + 1) > map->capacity)
+    {
+        /* Grow table and rehash */
+        MoveMap new_map;
+        new_map.size     = 0;
+        new_map.capacity = map->capacity ? 2*map->capacity : 1024;
+        new_map.keys     = calloc(new_map.capacity, sizeof(Move*));
+        new_map.ids      = malloc(new_map.capacity*sizeof(unsigned long));
+        if (new_map.keys == NULL || new_map.ids == NULL)
+        {
+            free(new_map.keys);
+            free(new_map.ids);
+            return 0;
+        }
+        for (i = 0; i < map->capacity; ++i)
+        {
+            if (map->keys[i] != NULL)
+            {
+                move_map_put(&new_map, map->keys[i], map->ids[i]);
+            }
+        }
+        free(map->keys);
+        free(map->ids);
+        *map = new_map;
+    }
+
+    i = move_map_find(map, move);
+    if (map->keys[i] == NULL) ++map->size;
+    map->keys[i] = move;
+    map->ids[i]  = id;
+    return 1;
+}
+
+static void write_u32(FILE *fp, unsigned long value)
+{
+    unsigned char buf[4];
+    util_put_u32(buf, value);
+    fwrite(buf, 1, sizeof(buf), fp);
+}
+
+static int read_u32(FILE *fp, unsigned long *value)
+{
+    unsigned char buf[4];
+    if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf)) return 0;
+    *value = util_get_u32(buf);
+    return 1;
+}
+
+/* Write all moves in the trace ending with `move' that have not been
+   written yet, oldest first. */
+static int write_moves(FILE *fp, MoveMap *map, Move *move)
+{
+    Move **stack = NULL, *m;
+    size_t size = 0, capacity = 0;
+
+    /* Collect moves that have not been written yet */
+    for (m = move; m != NULL && move_map_get(map, m) == 0; m = m->prev)
+    {
+        if (size == capacity)
+        {
+            Move **new_stack;
+            capacity = capacity ? 2*capacity : 256;
+            new_stack = realloc(stack, capacity*sizeof(Move*));
+            if (new_stack == NULL)
+            {
+                free(stack);
+                return 0;
+            }
+            stack = new_stack;
+        }
+        stack[size++] = m;
+    }
+
+    /* Write them in reverse order, so parents come first */
+    while (size > 0)
+    {
+        m = stack[--size];
+        if (!move_map_put(map, m, map->size + 1))
+        {
+            free(stack);
+            return 0;
+        }
+        write_u32(fp, move_map_get(map, m->prev));
+        putc(m->r1, fp);
+        putc(m->c1, fp);
+        putc(m->r2, fp);
+        putc(m->c2, fp);
+    }
+
+    free(stack);
+    return 1;
+}
+
+static void write_queue(FILE *fp, Game *game, MoveMap *map, PriorityQueue *pq)
+{
+    size_t i;
+    int r, c;
+
+    write_u32(fp, pq_size(pq));
+    for (i = 0; i < pq_size(pq); ++i)
+    {
+        Board *board = pq_elem_data(pq, i);
+        write_u32(fp, (unsigned long)pq_elem_prio(pq, i));
+        write_u32(fp, (unsigned long)board->score);
+        write_u32(fp, (unsigned long)board->moves);
+        write_u32(fp, move_map_get(map, board->last_move));
+        for (c = 0; c < game->width; ++c)
+        {
+            write_u32(fp, board->drops[c] - game->drops_begin[c]);
+        }
+        for (r = 0; r < game->height; ++r)
+        {
+            fwrite(&FLD(board, r, 0), sizeof(Field), game->width, fp);
+        }
+    }
+}
+
+int snapshot_save(const char *path, Game *game, const SearchState *state)
+{
+    char tmp_path[1024];
+    MoveMap map = { 0, 0, NULL, NULL };
+    unsigned long long hash = game_hash(game);
+    PriorityQueue *queues[2];
+    size_t i, q;
+    FILE *fp;
+    int ok;
+
+    if (strlen(path) + 16 > sizeof(tmp_path)) return 0;
+    sprintf(tmp_path, "%s.%d.tmp", path, (int)getpid());
+    if ((fp = fopen(tmp_path, "wb")) == NULL) return 0;
+
+    /* Header */
+    write_u32(fp, SNAPSHOT_MAGIC);
+    write_u32(fp, SNAPSHOT_VERSION);
+    write_u32(fp, (unsigned long)(hash & 0xffffffffUL));
+    write_u32(fp, (unsigned long)(hash >> 32));
+    write_u32(fp, state->phase);
+    write_u32(fp, state->move_limit);
+    write_u32(fp, state->best_score);
+
+    /* Move DAG */
+    ok = write_moves(fp, &map, state->best_move);
+    queues[0] = state->pq;
+    queues[1] = state->nq;
+    for (q = 0; q < 2; ++q)
+    {
+        for (i = 0; ok && i < pq_size(queues[q]); ++i)
+        {
+            Board *board = pq_elem_data(queues[q], i);
+            ok = write_moves(fp, &map, board->last_move);
+        }
+    }
+    write_u32(fp, NO_MORE_MOVES);
+    write_u32(fp, move_map_get(&map, state->best_move));
+
+    /* Queued boards */
+    write_queue(fp, game, &map, state->pq);
+    write_queue(fp, game, &map, state->nq);
+
+    free(map.keys);
+    free(map.ids);
+
+    if (ferror(fp)) ok = 0;
+    if (fclose(fp) != 0 || !ok || rename(tmp_path, path) != 0)
+    {
+        remove(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+/* Read a queue of boards; returns the queue or NULL on failure. */
+static PriorityQueue *read_queue( FILE *fp, Game *game, Move **moves,
+                                  unsigned long num_moves, size_t capacity )
+{
+    unsigned long size, prio, score, nmoves, id, pos;
+    PriorityQueue *pq;
+    int r, c;
+
+    if (!read_u32(fp, &size)) return NULL;
+    pq = pq_create(size > capacity ? size : capacity);
+    if (pq == NULL) return NULL;
+    while (pq_size(pq) < size)
+    {
+        Board *board;
+
+        if ( !read_u32(fp, &prio) || !read_u32(fp, &score) ||
+             !read_u32(fp, &nmoves) || !read_u32(fp, &id) || id > num_moves ||
+             (board = board_clone(game->initial)) == NULL ) goto failed;
+
+        board->score = (int)score;
+        board->moves = (int)nmoves;
+        board->last_move = move_ref(id ? moves[id - 1] : NULL);
+        pq_push(pq, (int)prio, board);
+        for (c = 0; c < game->width; ++c)
+        {
+            if ( !read_u32(fp, &pos) || (long)pos >=
+                 game->drops_end[c] - game->drops_begin[c] ) goto failed;
+            board->drops[c] = game->drops_begin[c] + pos;
+        }
+        for (r = 0; r < game->height; ++r)
+        {
+            if ( fread(&FLD(board, r, 0), sizeof(Field), game->width, fp)
+                 != (size_t)game->width ) goto failed;
+        }
+    }
+    return pq;
+
+failed:
+    while (!pq_empty(pq)) board_free(pq_pop_min(pq));
+    pq_destroy(pq);
+    return NULL;
+}
+
+int snapshot_load( const char *path, Game *game, SearchState *state,
+                   size_t capacity )
+{
+    unsigned long magic, version, hash_lo, hash_hi, phase, move_limit;
+    unsigned long best_score, prev, best_id;
+    unsigned long long hash = game_hash(game);
+    Move **moves = NULL, *move;
+    size_t num_moves = 0, max_moves = 0;
+    FILE *fp;
+    int ok = 0;
+
+    if ((fp = fopen(path, "rb")) == NULL) return 0;
+
+    /* Check header */
+    if ( !read_u32(fp, &magic) || magic != SNAPSHOT_MAGIC ||
+         !read_u32(fp, &version) || version != SNAPSHOT_VERSION ||
+         !read_u32(fp, &hash_lo) || hash_lo != (hash & 0xffffffffUL) ||
+         !read_u32(fp, &hash_hi) || hash_hi != (hash >> 32) ||
+         !read_u32(fp, &phase) || !read_u32(fp, &move_limit) ||
+         !read_u32(fp, &best_score) ) goto failed;
+
+    /* Rebuild move DAG */
+    while (read_u32(fp, &prev) && prev != NO_MORE_MOVES)
+    {
+        int r1 = getc(fp), c1 = getc(fp), r2 = getc(fp), c2 = getc(fp);
+        if (c2 == EOF || prev > num_moves) goto failed;
+        if (num_moves == max_moves)
+        {
+            Move **new_moves;
+            max_moves = max_moves ? 2*max_moves : 1024;
+            new_moves = realloc(moves, max_moves*sizeof(Move*));
+            if (new_moves == NULL) goto failed;
+            moves = new_moves;
+        }
+        move = move_create( move_ref(prev ? moves[prev - 1] : NULL),
+                            r1, c1, r2, c2 );
+        if (move == NULL) goto failed;
+        moves[num_moves++] = move;
+    }
+    if (prev != NO_MORE_MOVES) goto failed;
+    if (!read_u32(fp, &best_id) || best_id > num_moves) goto failed;
+
+    /* Read queues */
+    state->pq = read_queue(fp, game, moves, num_moves, capacity);
+    if (state->pq == NULL) goto failed;
+    state->nq = read_queue(fp, game, moves, num_moves, capacity);
+    if (state->nq == NULL)
+    {
+        while (!pq_empty(state->pq)) board_free(pq_pop_min(state->pq));
+        pq_destroy(state->pq);
+        goto failed;
+    }
+    state->phase      = (int)phase;
+    state->move_limit = (int)move_limit;
+    state->best_score = (int)best_score;
+    state->best_move  = move_ref(best_id ? moves[best_id - 1] : NULL);
+    ok = 1;
+
+failed:
+    /* Release references held by the move table */
+    while (num_moves > 0) move_deref(moves[--num_moves]);
+    free(moves);
+    fclose(fp);
+    return ok;
+}
@@ -0,0 +1,39 @@
+#ifndef SNAPSHOT_H_INCLUDED
+#define SNAPSHOT_H_INCLUDED
+
+/* Binary snapshots of the search state, so that an interrupted search can be
+   resumed later (possibly by a different process).
+
+   A snapshot contains the boards in both queues with their priorities, the
+   best score and corresponding trace, and the current move limit. Move
+   traces are stored as a DAG: a move shared by several boards is written
+   only once. All integers are stored in little-endian byte order.
+*/
+
+#include "Game.h"
+#include "PriorityQueue.h"
+
+/* Search state saved in a snapshot */
+typedef struct SearchState
+{
+    int             phase;          /* search phase (0 or 1) */
+    int             move_limit;     /* current move limit */
+    int             best_score;     /* best score found so far */
+    Move            *best_move;     /* trace of the best board found */
+    PriorityQueue   *pq, *nq;       /* queues of boards (with priorities) */
+} SearchState;
+
+/* Write a snapshot of the search state to the given path. The snapshot is
+   written to a temporary file first, and then renamed.
+   Returns non-zero on success, or zero on failure. */
+int snapshot_save(const char *path, Game *game, const SearchState *state);
+
+/* Load a snapshot for the given game from the given path. The queues are
+   created with at least the given capacity, and the state takes a
+   reference to the best move.
+   Returns non-zero on success, or zero on failure (including when the
+   snapshot was made for a different game). */
+int snapshot_load( const char *path, Game *game, SearchState *state,
+                   size_t capacity );
+
+#endif /* ndef SNAPSHOT_H_INCLUDED */
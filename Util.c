@@ -0,0 +1,24 @@
+#include "Util.h"
+#include <stdlib.h>
+#include <sys/time.h>
+
+long long util_ustime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return 1000000LL*tv.tv_sec + tv.tv_usec;
+}
+
+void util_put_u32(unsigned char *p, unsigned long value)
+{
+    p[0] = (unsigned char)(value >>  0);
+    p[1] = (unsigned char)(value >>  8);
+    p[2] = (unsigned char)(value >> 16);
+    p[3] = (unsigned char)(value >> 24);
+}
+
+unsigned long util_get_u32(const unsigned char *p)
+{
+    return (unsigned long)p[0] <<  0 | (unsigned long)p[1] <<  8 |
+           (unsigned long)p[2] << 16 | (unsigned long)p[3] << 24;
+}
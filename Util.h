@@ -0,0 +1,16 @@
+#ifndef UTIL_H_INCLUDED
+#define UTIL_H_INCLUDED
+
+/* Small helpers shared by the player, its tools and the modules that read
+   and write binary data. */
+
+/* Return the current wall clock time in microseconds. */
+long long util_ustime();
+
+/* Store a 32-bit value at `p' in little-endian byte order. */
+void util_put_u32(unsigned char *p, unsigned long value);
+
+/* Return the 32-bit little-endian value stored at `p'. */
+unsigned long util_get_u32(const unsigned char *p);
+
+#endif /* ndef UTIL_H_INCLUDED */
@@ -0,0 +1,217 @@
+/* Benchmark for board_clone()/board_move() throughput with multiple threads.
+
+   Usage: bench [<seconds>] [<directory>]
+
+   A set of parent boards is created by the main thread (as happens in the
+   search, where boards are created by whichever thread generated them), and
+   all threads repeatedly create a child of a random parent for each valid
+   move. Cloning and moving are timed separately: clones are made with
+   board_clone() (and freed again), while moves are performed on a scratch
+   board after copying the parent to it with board_copy(). The time taken by
+   the copies is measured in a separate pass over the same boards and moves,
+   and subtracted. This is measured in three configurations:
+
+     plain:    threads are not pinned, boards are allocated with malloc()
+     pinned:   threads are pinned to CPUs, boards come from per-node pools
+     replica:  as pinned, but each thread first copies the parent to a local
+               replica, and clones the replica instead
+
+   On a multi-socket machine, the pinned and replica configurations should
+   show higher throughput, since clones are made from and to local memory.
+*/
+
+#include "Game.h"
+#include "MemDebug.h"
+#include "Moves.h"
+#include "Numa.h"
+#include "Util.h"
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Number of parent boards */
+#define NUM_PARENTS (1024)
+
+/* Number of clones made between checks of the time */
+#define BATCH_SIZE  (1024)
+
+static Candidate candidates[MAX_MOVES];
+static int num_candidates;
+
+/* Create parent boards by performing random moves from the initial board. */
+static void create_parents(Game *game, Board **parents)
+{
+    Board *board = board_clone(game->initial);
+    unsigned rng = 12345;
+    int n, tries;
+
+    for (n = 0; n < NUM_PARENTS; ++n)
+    {
+        for (tries = 0; tries < 10*num_candidates; ++tries)
+        {
+            const Candidate *cand;
+
+            rng = rng*1103515245 + 12345;
+            cand = &candidates[(rng >> 8)%num_candidates];
+            if (move_valid_candidate(board, cand))
+            {
+                board_move( board, cand->r, cand->c,
+                            cand->r + cand->vert, cand->c + !cand->vert, 0 );
+                break;
+            }
+        }
+        parents[n] = board_clone(board);
+        if (tries == 10*num_candidates)
+        {
+            /* Dead end: start over */
+            board_copy(board, game->initial);
+        }
+    }
+    board_free(board);
+}
+
+/* Pick a random parent, copied to the replica if not NULL. */
+static Board *pick_parent(Board **parents, unsigned *rng, Board *replica)
+{
+    Board *parent;
+
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 17;
+    *rng ^= *rng << 5;
+    parent = parents[*rng%NUM_PARENTS];
+    if (replica != NULL)
+    {
+        board_copy(replica, parent);
+        parent = replica;
+    }
+    return parent;
+}
+
+/* Make children of a batch of random parents, one for each valid move, in
+   one of three ways: cloning (mode 0), copying to the scratch board (mode
+   1), or copying to the scratch board and moving (mode 2). Returns the
+   number of children made. */
+static long long make_children( Board **parents, unsigned *rng,
+                                Board *replica, Board *scratch, int mode )
+{
+    long long count = 0;
+    int n, i;
+
+    for (n = 0; n < BATCH_SIZE; ++n)
+    {
+        Board *parent = pick_parent(parents, rng, replica);
+        for (i = 0; i < num_candidates; ++i)
+        {
+            const Candidate *cand = &candidates[i];
+            if (!move_valid_candidate(parent, cand)) continue;
+            if (mode == 0)
+            {
+                board_free(board_clone(parent));
+            }
+            else
+            {
+                board_copy(scratch, parent);
+                if (mode == 2)
+                {
+                    board_move( scratch, cand->r, cand->c,
+                                cand->r + cand->vert, cand->c + !cand->vert,
+                                0 );
+                }
+            }
+            ++count;
+        }
+    }
+    return count;
+}
+
+/* Run the benchmark for the given time, and print the throughput. */
+static void run(const char *name, Game *game, Board **parents,
+                long long max_usec, int use_replica)
+{
+    long long time_start = util_ustime();
+    long long clones = 0, moves = 0;
+    long long clone_usec = 0, move_usec = 0;    /* summed over threads */
+    int threads = omp_get_max_threads();
+
+    #pragma omp parallel reduction(+:clones, moves, clone_usec, move_usec)
+    {
+        Board *replica = use_replica ? board_clone(game->initial) : NULL;
+        Board *scratch = board_clone(game->initial);
+        unsigned seed = 2463534242U + 7919U*omp_get_thread_num();
+
+        while (util_ustime() - time_start < max_usec)
+        {
+            unsigned rng;
+            long long t0, t1, t2, t3;
+
+            /* Each pass uses the same parents (and hence moves) */
+            rng = seed;
+            t0 = util_ustime();
+            clones += make_children(parents, &rng, replica, scratch, 0);
+            t1 = util_ustime();
+            rng = seed;
+            make_children(parents, &rng, replica, scratch, 1);
+            t2 = util_ustime();
+            rng = seed;
+            moves += make_children(parents, &rng, replica, scratch, 2);
+            t3 = util_ustime();
+            seed = rng;
+
+            clone_usec += t1 - t0;
+            move_usec  += (t3 - t2) - (t2 - t1);
+        }
+        board_free(scratch);
+        board_free(replica);
+    }
+
+    printf( "%-8s %12.0f clones/sec %12.0f moves/sec\n", name,
+            clone_usec > 0 ? 1e6*threads*clones/clone_usec : 0.0,
+            move_usec > 0 ? 1e6*threads*moves/move_usec : 0.0 );
+}
+
+int main(int argc, char *argv[])
+{
+    long long max_usec = 5000000;
+    const char *dir = ".";
+    Board *parents[NUM_PARENTS];
+    Game *game;
+    int n;
+
+    mem_debug_report_at_exit(stderr);
+
+    if (argc > 3)
+    {
+        printf("Usage: bench [<seconds>] [<directory>]\n");
+        return 1;
+    }
+    if (argc > 1) max_usec = (long long)(1e6*atof(argv[1]));
+    if (argc > 2) dir = argv[2];
+
+    game = game_load(dir);
+    if (game == NULL)
+    {
+        perror("failed to load board definition");
+        return 1;
+    }
+    num_candidates = move_generate_candidates(game->initial, candidates);
+    create_parents(game, parents);
+
+    printf( "%d threads, %d NUMA nodes, %dx%d board\n",
+            omp_get_max_threads(), numa_num_nodes(),
+            game->width, game->height );
+
+    run("plain", game, parents, max_usec, 0);
+
+    board_pool_init(numa_num_nodes());
+    #pragma omp parallel
+    board_pool_set_node(numa_pin_thread(omp_get_thread_num()));
+
+    run("pinned", game, parents, max_usec, 0);
+    run("replica", game, parents, max_usec, 1);
+
+    for (n = 0; n < NUM_PARENTS; ++n) board_free(parents[n]);
+    board_pool_destroy();
+    game_free(game);
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Helper for the profile-guided build (see the pgo target in the Makefile).
+#
+#   pgo.sh run <player> <iterations> <case>...
+#       Runs the player on each case (in a scratch copy of the case, so the
+#       corpus is not modified) in deterministic mode with the given
+#       iteration budget and one thread, and prints the search throughput
+#       for each case in iterations/sec. Every build performs exactly the
+#       same search, so only its speed differs.
+#
+#   pgo.sh report <before> <after>
+#       Compares two outputs of the run command.
+
+usage()
+{
+    echo "Usage: pgo.sh run <player> <iterations> <case>..."
+    echo "       pgo.sh report <before> <after>"
+    exit 1
+}
+
+case "$1" in
+run)
+    [ $# -ge 4 ] || usage
+    case "$2" in
+    /*) player=$2 ;;
+    *)  player=`pwd`/$2 ;;
+    esac
+    iterations=$3
+    shift 3
+    tmp=`mktemp -d` || exit 1
+    for dir in "$@"
+    do
+        cp "$dir/speelveld.txt" "$dir/kolommen.txt" "$tmp/" || exit 1
+        # Total iterations over both search phases, divided by total time
+        # (the player writes uitvoer.txt to its working directory)
+        ( cd "$tmp" && OMP_NUM_THREADS=1 "$player" --deterministic \
+                       --iterations "$iterations" . 2>/dev/null ) |
+            awk -v name="`basename "$dir"`" '
+                / iterations in / { n += $1; t += $4 + 0 }
+                END { printf("%-20s %12.0f\n", name, t > 0 ? n/t : 0) }'
+    done
+    rm -rf "$tmp"
+    ;;
+report)
+    [ $# -eq 3 ] || usage
+    echo "case                 before (it/s)  after (it/s)  change"
+    join "$2" "$3" | awk '
+        { printf("%-20s %13.0f %13.0f %6.1f%%\n", $1, $2, $3,
+                 $2 > 0 ? 100*($3 - $2)/$2 : 0)
+          before += $2; after += $3 }
+        END { printf("%-20s %13.0f %13.0f %6.1f%%\n", "total", before, after,
+                     before > 0 ? 100*(after - before)/before : 0) }'
+    ;;
+*)
+    usage
+    ;;
+esac
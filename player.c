@@ -1,14 +1,143 @@
+#include "Cache.h"
+#include "Exchange.h"
 #include "Game.h"
 #include "MemDebug.h"
 #include "Moves.h"
+#include "MultiQueue.h"
+#include "Numa.h"
+#include "Playout.h"
 #include "PriorityQueue.h"
+#include "Rollout.h"
+#include "Snapshot.h"
+#include "Util.h"
 #include <assert.h>
+#include <limits.h>
 #include <omp.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>   /* gettimeofday() */
+
+/* Default time limit in seconds (14 minutes, 55 seconds) */
+#define DEFAULT_TIME_LIMIT  (15*60 - 5)
+
+/* Bounds on the queue capacities selected by the tuner */
+#define QUEUE_CAP_MIN       (100)
+#define QUEUE_CAP_MAX       (1000000)
+
+/* Number of queue shards per thread */
+#define SHARDS_PER_THREAD   (2)
+
+/* Default memory budget in megabytes */
+#define DEFAULT_MEMORY_LIMIT (1024)
+
+/* Default fraction of the time limit spent on playouts */
+#define DEFAULT_PLAYOUT_FRACTION (0.05)
+
+/* Maximum number of times a single playout backtracks */
+#define PLAYOUT_RETRIES (1000)
+
+/* Fraction of the remaining time spent on depth-first search (if enabled)
+   before searching for the maximum score */
+#define DFS_TIME_FRACTION (0.5)
+
+/* Time the coordinator waits for workers after the time limit, in seconds */
+#define COORDINATOR_GRACE (30)
+
+/* Number of upcoming drops considered by refill_bonus() */
+#define REFILL_LOOKAHEAD (3)
+
+/* Default interval between snapshots in seconds */
+#define DEFAULT_SNAPSHOT_INTERVAL (60)
+
+/* State of the adaptive controller that sizes the queues and decides when
+   to end the first search phase. It is updated once per second. */
+typedef struct Tuner
+{
+    long long   last_time;          /* time of last update */
+    int         last_iterations;    /* iterations at time of last update */
+    long long   children;           /* boards generated since last update */
+    double      rate;               /* expansions per second (smoothed) */
+    double      branching;          /* children per expansion (smoothed) */
+} Tuner;
+
+static long long memory_limit;  /* memory budget for boards and traces */
+
+/* Rollout evaluation of new boards (disabled if rollout_count == 0): */
+static int rollout_count = 0;
+static int rollout_depth = 20;
+static RolloutPolicy rollout_policy = ROLLOUT_RANDOM;
+
+/* Whether threads are pinned to CPUs (and boards pooled per NUMA node) */
+static bool pin_threads = false;
+
+/* Deterministic search (see search()): */
+static bool deterministic = false;
+
+/* Budgets for the number of iterations (boards expanded) and the number of
+   calls to board_move() (0 if unlimited). If either is set, the search ends
+   when a budget is used up instead of at the time limit: ustime() returns a
+   virtual time that advances with the fraction of the budget used, so all
+   time-dependent decisions depend on the amount of work done only. */
+static long long iteration_budget = 0;
+static long long move_budget = 0;
+static long long iterations_done = 0;
+static long long virtual_time_limit;
+
+/* Progress reports are printed when the number of iterations reaches the
+   next number in the sequence 1000, 2000, 5000, 10000, 20000, ... */
+static long long next_report = 1000;
+static long long wall_start;    /* wall-clock time at start of program */
+
+/* Per-thread search state (padded to avoid false sharing) */
+typedef struct ThreadState
+{
+    Board       *scratch;       /* scratch board for rollouts */
+    Board       *replica;       /* local copy of the board being expanded */
+    unsigned    rng;            /* random number generator state */
+    char        padding[64 - 2*sizeof(Board*) - sizeof(unsigned)];
+} ThreadState;
+
+/* Children of an expanded board, with their priorities */
+typedef struct Expansion
+{
+    int         count;                  /* number of children */
+    Board       *children[MAX_MOVES];
+    int         prio[MAX_MOVES];
+} Expansion;
+
+/* Depth-first search state of a single thread */
+typedef struct DfsThread
+{
+    Board           *board;         /* working board */
+    UndoLog         *undo;          /* undo log for backtracking */
+    int             *order;         /* children of the nodes on the path */
+    size_t          order_size;     /* number of entries used in order */
+    size_t          order_capacity; /* number of entries allocated */
+    size_t          *first;         /* start of each depth's children */
+    int             *count;         /* number of children at each depth */
+    unsigned short  *rank;          /* rank of child explored at each depth */
+    unsigned short  *trace;         /* candidate indices of moves played */
+    unsigned short  *best_trace;    /* trace of deepest board found */
+    int             best_length;    /* length of best_trace */
+    int             best_score;     /* score at the end of best_trace */
+    long long       nodes;          /* number of nodes visited */
+} DfsThread;
+
+/* Set when a depth-first search should stop */
+static volatile bool dfs_done = false;
+
+/* Snapshots of the search state: */
+static const char *snapshot_path = NULL;
+static long long snapshot_interval;
+static volatile sig_atomic_t terminate_requested = 0;
+
+/* File to write the solution to in binary trace format (if not NULL) */
+static const char *binary_trace_path = NULL;
+
+/* Connection to the coordinator (in worker mode) */
+static Exchange *exchange = NULL;
 
 static Move *best_move = NULL;  /* game trace for best score */
 static int best_score = 0;      /* best possible score */
@@ -17,34 +146,265 @@ static int best_score = 0;      /* best possible score */
 static Candidate candidates[MAX_MOVES];
 static int num_candidates;
 
-/* Return the time in microseconds */
+/* Dummy move for evaluating boards not created by a known move */
+static const Candidate no_candidate;
+
+/* Return the time in microseconds, which is virtual if a budget is set */
 static long long ustime()
 {
-#ifdef TIME_SIM
-    static long long counter = 0;
-    counter += 1000;
-    return counter;
-#else
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return 1000000LL*tv.tv_sec + tv.tv_usec;
-#endif
+    double used = 0;
+
+    if (iteration_budget == 0 && move_budget == 0) return util_ustime();
+    if (iteration_budget > 0)
+    {
+        used = (double)iterations_done/iteration_budget;
+    }
+    if (move_budget > 0 && (double)board_move_count()/move_budget > used)
+    {
+        used = (double)board_move_count()/move_budget;
+    }
+    return (long long)(used*virtual_time_limit);
+}
+
+/* Print a progress report if the number of iterations reached the next
+   report point. Reports at fixed iteration counts allow comparing search
+   quality (best score) separately from throughput (time taken). */
+static void report_progress()
+{
+    long long elapsed = util_ustime() - wall_start;
+
+    if (iterations_done < next_report) return;
+    printf( "Report: nodes=%lld board_moves=%lld best_score=%d "
+            "time=%.3fs nodes/sec=%.0f\n", iterations_done,
+            (long long)board_move_count(), best_score, 1e-6*elapsed,
+            elapsed > 0 ? 1e6*iterations_done/elapsed : 0.0 );
+    while (next_report <= iterations_done)
+    {
+        long long scale = 1;
+        while (next_report >= 10*scale) scale *= 10;
+        if (next_report == 2*scale) next_report = 5*scale;
+        else next_report *= 2;
+    }
+}
+
+static void handle_sigterm(int sig)
+{
+    (void)sig; /* unused */
+    terminate_requested = 1;
+}
+
+/* Write a snapshot of the search state to snapshot_path */
+static void save_snapshot( Game *game, int phase, int move_limit,
+                           MultiQueue *pq, MultiQueue *nq )
+{
+    SearchState state;
+    state.phase      = phase;
+    state.move_limit = move_limit;
+    state.best_score = best_score;
+    state.best_move  = best_move;
+    state.pq         = mq_collect(pq);
+    state.nq         = mq_collect(nq);
+    if ( state.pq == NULL || state.nq == NULL ||
+         !snapshot_save(snapshot_path, game, &state) )
+    {
+        fprintf(stderr, "failed to write snapshot to %s\n", snapshot_path);
+    }
+    if (state.pq != NULL) pq_destroy(state.pq);
+    if (state.nq != NULL) pq_destroy(state.nq);
+}
+
+/* Return the number of bytes allocated for boards and move traces. */
+static long long memory_used()
+{
+    return (long long)board_memory_used() + (long long)move_memory_used();
+}
+
+/* Add a board to a queue. If the queue is full, or the memory budget is
+   exceeded, a low-priority board (which may be the new board) is removed
+   and returned; otherwise, NULL is returned. Safe to call concurrently. */
+static Board *push_board(MultiQueue *pq, int prio, Board *board)
+{
+    return mq_push(pq, prio, board, memory_used() > memory_limit);
+}
+
+/* Evict lowest-priority boards from both queues until memory usage is
+   within the budget again (but always leave at least one board). Dead moves
+   still queued for reclamation are freed first. */
+static void enforce_memory_limit(MultiQueue *pq, MultiQueue *nq)
+{
+    if (memory_used() > memory_limit) move_reclaim();
+    while (memory_used() > memory_limit && mq_size(pq) + mq_size(nq) > 1)
+    {
+        if ( mq_empty(nq) ||
+             (!mq_empty(pq) && mq_min_prio(pq) <= mq_min_prio(nq)) )
+        {
+            board_free(mq_pop_min(pq, NULL));
+        }
+        else
+        {
+            board_free(mq_pop_min(nq, NULL));
+        }
+    }
+}
+
+/* Update measured expansion rate and branching factor. */
+static void tuner_update(Tuner *t, long long now, int iterations)
+{
+    int expanded = iterations - t->last_iterations;
+    if (now > t->last_time && expanded > 0)
+    {
+        double rate = 1e6*expanded/(now - t->last_time);
+        double branching = (double)t->children/expanded;
+        if (t->rate == 0)
+        {
+            t->rate = rate;
+            t->branching = branching;
+        }
+        else
+        {
+            t->rate = 0.5*t->rate + 0.5*rate;
+            t->branching = 0.5*t->branching + 0.5*branching;
+        }
+    }
+    t->last_time = now;
+    t->last_iterations = iterations;
+    t->children = 0;
+}
+
+/* Select a queue capacity. There is no point in keeping more boards than
+   can be expanded before the search must advance to the next level (either
+   the move limit in the second phase, or the deepest board found so far in
+   the first phase), so the capacity is chosen as the number of children
+   generated in the time available per remaining level, bounded by the
+   memory budget. */
+static size_t tuner_capacity( const Tuner *t, long long time_left,
+                              int levels_left, size_t current_cap )
+{
+    double cap = QUEUE_CAP_MAX;
+    long long mem;
+
+    if (t->rate > 0 && levels_left > 0 && time_left > 0)
+    {
+        cap = t->branching * t->rate * 1e-6*time_left / levels_left;
+    }
+
+    mem = memory_used();
+    if (mem > 0 && cap > (double)current_cap*memory_limit/mem)
+    {
+        cap = (double)current_cap*memory_limit/mem;
+    }
+
+    if (cap < QUEUE_CAP_MIN) cap = QUEUE_CAP_MIN;
+    if (cap > QUEUE_CAP_MAX) cap = QUEUE_CAP_MAX;
+    return (size_t)cap;
+}
+
+/* Return the time to reserve for the second search phase. This is at least
+   the time needed to advance the move limit through all levels at the
+   measured expansion rate, and at least a fraction of the total time that
+   grows with the board size (larger boards need more time per level). */
+static long long tuner_phase2_reserve( const Tuner *t, const Game *game,
+                                       long long total_usec )
+{
+    double frac = 0.1 + 0.2*game->width*game->height/(MAX_WIDTH*MAX_HEIGHT);
+    double reserve = frac*total_usec;
+
+    if (t->rate > 0 && 1e6*MOVE_LIMIT/t->rate > reserve)
+    {
+        reserve = 1e6*MOVE_LIMIT/t->rate;
+    }
+    if (reserve > 0.5*total_usec) reserve = 0.5*total_usec;
+    return (long long)reserve;
+}
+
+/* Change the capacity of a queue, freeing boards with lowest priority if
+   necessary. Small adjustments are ignored to avoid needless reallocation. */
+static void resize_board_queue(MultiQueue *pq, size_t cap)
+{
+    size_t old_cap = mq_capacity(pq);
+    if (8*cap > 7*old_cap && 8*cap < 9*old_cap) return;
+    while (mq_size(pq) > cap) board_free(mq_pop_min(pq, NULL));
+    mq_set_capacity(pq, cap);
 }
 
 /* Merge nq into pq, freeing extra boards */
-static void merge_board_queues(PriorityQueue *pq, PriorityQueue *nq)
+static void merge_board_queues(MultiQueue *pq, MultiQueue *nq)
+{
+    while (!mq_empty(nq))
+    {
+        int prio;
+        Board *board = mq_pop_max(nq, &prio);
+        board_free(push_board(pq, prio, board));
+    }
+}
+
+/* Send the best solution to the coordinator if it has improved, and add
+   better solutions found by other workers to the queues. */
+static void exchange_solutions( MultiQueue *pq, MultiQueue *nq,
+                                int move_limit,
+                                int (*heuristic) (const Board *,
+                                                  const Candidate *) )
+{
+    Board *board;
+
+    if (exchange == NULL) return;
+    if (!exchange_send(exchange, best_score, best_move))
+    {
+        fprintf(stderr, "lost connection to coordinator\n");
+        exchange_close(exchange);
+        exchange = NULL;
+        return;
+    }
+    if ((board = exchange_receive(exchange)) != NULL)
+    {
+        printf( "Received solution: score=%d moves=%d\n",
+                board->score, board->moves );
+        if (board->score > best_score)
+        {
+            best_score = board->score;
+            move_deref(best_move);
+            best_move = move_ref(board->last_move);
+        }
+        board_free(push_board( board->moves < move_limit ? pq : nq,
+                               heuristic(board, &no_candidate), board ));
+    }
+}
+
+/* Free all boards in a queue and destroy it */
+static void free_board_queue(MultiQueue *pq)
 {
-    while (!pq_empty(nq))
+    while (!mq_empty(pq)) board_free(mq_pop_min(pq, NULL));
+    mq_destroy(pq);
+}
+
+/* Estimate how likely the blocks that drop next into the columns of a move
+   are to form new groups: count the top blocks of the neighbouring columns
+   with a colour among the next few drops. (Off-board neighbours are border
+   fields, which never match.) Boards not created by a known move get no
+   bonus. */
+static int refill_bonus(const Board *board, const Candidate *move)
+{
+    int c, d, bonus = 0;
+
+    if (move == &no_candidate) return 0;
+
+    for (c = move->c; c <= move->c + !move->vert; ++c)
     {
-        if (pq_full(pq)) board_free(pq_pop_min(pq));
-        pq_push(pq, pq_max_prio(nq), pq_max_data(nq));
-        pq_pop_max(nq);
+        unsigned mask = DROP_COLOURS(board, c, REFILL_LOOKAHEAD);
+        for (d = c - 1; d <= c + 1; d += 2)
+        {
+            int f = FLD(board, 0, d);
+            if (f > 0 && (mask >> f & 1)) ++bonus;
+        }
     }
+
+    return bonus;
 }
 
 static int heuristic1(const Board *board, const Candidate *move)
 {
-    return 10000*board->moves - move->r + board->score/100;
+    return 10000*board->moves - move->r + board->score/100 +
+           refill_bonus(board, move);
 }
 
 static int heuristic2(const Board *board, const Candidate *move)
@@ -53,35 +413,232 @@ static int heuristic2(const Board *board, const Candidate *move)
     return board->score;
 }
 
-/* Time-bounded search for optimal score. Does not work well on "hard" sets. */
+/* Evaluate a new board, using rollouts if enabled. In deterministic mode,
+   the rollouts use a random number generator seeded with the board's hash,
+   instead of that of the thread evaluating it. */
+static int evaluate( const Board *board, const Candidate *move,
+                     unsigned long long hash,
+                     int (*heuristic) (const Board *, const Candidate *),
+                     ThreadState *threads )
+{
+    ThreadState *rt;
+    unsigned rng;
+
+    if (rollout_count == 0) return heuristic(board, move);
+
+    rt = &threads[omp_get_thread_num()];
+    if (!deterministic)
+    {
+        return rollout_evaluate( board, rt->scratch, candidates,
+                                 num_candidates, rollout_count,
+                                 rollout_depth, rollout_policy, &rt->rng,
+                                 heuristic, move );
+    }
+    rng = (unsigned)(hash ^ hash >> 32) | 1;
+    return rollout_evaluate( board, rt->scratch, candidates, num_candidates,
+                             rollout_count, rollout_depth, rollout_policy,
+                             &rng, heuristic, move );
+}
+
+/* Expand a board with board_expand(), storing its children (in candidate
+   order) and their priorities in `exp'. Returns the number of children.
+   Safe to call concurrently. The number of duplicate children dropped is
+   added to `pruned'.
+
+   If threads are pinned, the board is first copied to a replica owned by
+   the expanding thread (and therefore allocated on its NUMA node), so the
+   children are cloned from local memory instead of from the node of the
+   thread that created the board. */
+static int expand_board( Board *board,
+                         int (*heuristic) (const Board *, const Candidate *),
+                         ThreadState *threads, long long *pruned,
+                         Expansion *exp )
+{
+    ThreadState *ts = &threads[omp_get_thread_num()];
+    Board *parent = board;
+    unsigned long long hashes[MAX_MOVES];
+    int moves[MAX_MOVES];
+    int i, num_children, dropped = 0;
+
+    if (pin_threads)
+    {
+        if (ts->replica == NULL)
+        {
+            ts->replica = board_clone(board->game->initial);
+            assert(ts->replica != NULL);
+        }
+        board_copy(ts->replica, board);
+        ts->replica->last_move = board->last_move;  /* borrowed */
+        parent = ts->replica;
+    }
+
+    num_children = board_expand( parent, candidates, num_candidates,
+                                 exp->children, moves, hashes, &dropped );
+    assert(num_children >= 0);
+    if (parent != board) parent->last_move = NULL;
+    *pruned += dropped;
+
+    for (i = 0; i < num_children; ++i)
+    {
+        /* Boards with infinite score end the game, so they are expanded next
+           regardless of the move limit */
+        Board *child = exp->children[i];
+        exp->prio[i] = child->score >= SCORE_LIMIT ? INT_MAX
+            : evaluate( child, &candidates[moves[i]], hashes[i],
+                        heuristic, threads );
+    }
+    exp->count = num_children;
+
+    return num_children;
+}
+
+/* Add the children of an expanded board to the appropriate queue: the
+   active queue if they are below the move limit (or end the game), or the
+   next queue otherwise. Safe to call concurrently. */
+static void push_children( Expansion *exp, MultiQueue *pq, MultiQueue *nq,
+                           int move_limit )
+{
+    int i;
+
+    for (i = 0; i < exp->count; ++i)
+    {
+        Board *board = exp->children[i];
+        bool active = board->moves < move_limit ||
+                      board->score >= SCORE_LIMIT;
+        board_free(push_board(active ? pq : nq, exp->prio[i], board));
+    }
+    exp->count = 0;
+}
+
+/* Time-bounded search for optimal score. Does not work well on "hard" sets.
+
+   Each iteration takes the best boards from the active queue (one for each
+   thread) and expands them in parallel. The queues are sharded, so threads
+   can add boards concurrently.
+
+   In deterministic mode, the queues have a single shard, and the children
+   of each board in the batch are collected first and added to the queues by
+   the main thread afterwards, in batch order and then in candidate order.
+   The queue operations are then independent of thread timing, and the
+   search is reproducible for a given number of threads (if the time limit
+   is replaced by an iteration budget).
+
+   `queue_cap' is the initial capacity of the queues; it is adjusted during
+   the search depending on the measured expansion rate and memory usage.
+   If `use_all_time' is false, the search ends early when the time left must
+   be reserved for the next phase. If `seed' is not NULL, the search starts
+   from that board in addition to the initial board. If `resume' is not NULL,
+   the search continues from the given (restored) state instead; the search
+   takes ownership of its queues. */
 static void search( Game *game, long long max_usec, bool use_all_time,
                     int (*heuristic) (const Board *, const Candidate *),
-                    size_t queue_cap )
+                    size_t queue_cap, Board *seed, SearchState *resume )
 {
     /* Priority queue for boards currently being processed */
-    PriorityQueue *pq = pq_create(queue_cap);
-    assert(pq != NULL);
+    MultiQueue *pq;
 
     /* Queue for boards with moves == move_limit */
-    PriorityQueue *nq = pq_create(queue_cap);
-    assert(nq != NULL);
+    MultiQueue *nq;
 
-    /* Time limiting */
+    /* Time limiting (wall_time is used for reporting only) */
     long long time_start = ustime();
+    long long wall_time = util_ustime();
     long long next_update = 0;
+    long long next_snapshot = snapshot_interval;
+    long long time_used = 0;
+    long long deadline = max_usec;
     int move_limit = use_all_time ? 1 : MOVE_LIMIT + 1;
     int iterations = 0;
+    int deepest = 0;
+    long long generated = 0, pruned = 0;   /* children (incl. duplicates) */
+    int n;
+
+    /* Adaptive tuning */
+    Tuner tuner;
+    memset(&tuner, 0, sizeof(tuner));
+
+    /* Search state for each thread */
+    int num_threads = omp_get_max_threads();
+    ThreadState *threads = calloc(num_threads, sizeof(ThreadState));
+    assert(threads != NULL);
+    for (n = 0; n < num_threads && rollout_count > 0; ++n)
+    {
+        threads[n].scratch = board_clone(game->initial);
+        assert(threads[n].scratch != NULL);
+        threads[n].rng = 2463534242U + 7919U*n;
+    }
+
+    /* Boards expanded in the current iteration, and their children (one
+       expansion per board in deterministic mode, or per thread otherwise) */
+    Board **batch = malloc(num_threads*sizeof(Board*));
+    Expansion *expansions = malloc(num_threads*sizeof(Expansion));
+    assert(batch != NULL && expansions != NULL);
+    int num_shards = num_threads > 1 && !deterministic ?
+                     SHARDS_PER_THREAD*num_threads : 1;
+
+    if (resume != NULL)
+    {
+        move_limit = resume->move_limit;
+        queue_cap = pq_capacity(resume->pq);
+    }
+
+    pq = mq_create(num_shards, queue_cap);
+    assert(pq != NULL);
+    nq = mq_create(num_shards, queue_cap);
+    assert(nq != NULL);
+
+    if (resume != NULL)
+    {
+        while (!pq_empty(resume->pq))
+        {
+            int prio = pq_max_prio(resume->pq);
+            board_free(mq_push(pq, prio, pq_pop_max(resume->pq), 0));
+        }
+        pq_destroy(resume->pq);
+        while (!pq_empty(resume->nq))
+        {
+            int prio = pq_max_prio(resume->nq);
+            board_free(mq_push(nq, prio, pq_pop_max(resume->nq), 0));
+        }
+        pq_destroy(resume->nq);
+    }
+    else
+    {
+        mq_push(pq, 0, board_clone(game->initial), 0);
+        if (seed != NULL)
+        {
+            Board *board = board_clone(seed);
+            assert(board != NULL);
+            mq_push( board->moves < move_limit ? pq : nq,
+                     heuristic(board, &no_candidate), board, 0 );
+        }
+    }
 
-    pq_push(pq, 0, board_clone(game->initial));
-    while (!pq_empty(pq) || !pq_empty(nq))
+    while (!mq_empty(pq) || !mq_empty(nq))
     {
-        long long time_used = ustime() - time_start;
-        if (time_used >= max_usec) break;
-        ++iterations;
+        time_used = ustime() - time_start;
+        if (time_used >= deadline)
+        {
+            if (deadline < max_usec) printf("Ending phase early.\n");
+            break;
+        }
+
+        /* Save search state periodically, or when asked to terminate */
+        if ( snapshot_path != NULL &&
+             (terminate_requested || time_used >= next_snapshot) )
+        {
+            save_snapshot(game, use_all_time, move_limit, pq, nq);
+            next_snapshot = time_used + snapshot_interval;
+        }
+        if (terminate_requested)
+        {
+            printf("Terminating search.\n");
+            break;
+        }
 
         if (use_all_time)
         {
-            if (pq_empty(pq))
+            if (mq_empty(pq))
             {
                 /* Increase move limit because we need the new boards */
                 ++move_limit;
@@ -96,128 +653,929 @@ static void search( Game *game, long long max_usec, bool use_all_time,
             }
         }
 
-        /* Take next best board from the heap */
-        Board *board = pq_pop_max(pq);
-        /* printf("%d %d\n", board->moves, board->score); */
+        enforce_memory_limit(pq, nq);
 
-        if (board->score > best_score)
+        /* Take next best boards from the queue */
+        int batch_size = 0;
+        bool game_over = false;
+        while (batch_size < num_threads && !mq_empty(pq))
         {
-            /* Update best score found */
-            best_score = board->score;
-            move_deref(best_move);
-            best_move = move_ref(board->last_move);
+            Board *board = mq_pop_max(pq, NULL);
+            batch[batch_size++] = board;
+            ++iterations;
+            ++iterations_done;
+
+            if (board->score > best_score)
+            {
+                /* Update best score found */
+                best_score = board->score;
+                move_deref(best_move);
+                best_move = move_ref(board->last_move);
+            }
+
+            if (board->moves > deepest) deepest = board->moves;
+            report_progress();
+
+            if (board->moves >= MOVE_LIMIT || board->score >= SCORE_LIMIT)
+            {
+                game_over = true;
+            }
         }
+        if (batch_size == 0) continue;
 
         if (next_update <= time_used)
         {
+            /* Retune queue capacities and phase deadline */
+            if (next_update > 0)
+            {
+                tuner_update(&tuner, time_used, iterations);
+                if (!use_all_time)
+                {
+                    deadline = max_usec -
+                        tuner_phase2_reserve(&tuner, game, max_usec);
+                }
+                queue_cap = tuner_capacity( &tuner, deadline - time_used,
+                    MOVE_LIMIT - (use_all_time ? move_limit : deepest),
+                    queue_cap );
+                resize_board_queue(pq, queue_cap);
+                resize_board_queue(nq, queue_cap);
+            }
+            exchange_solutions(pq, nq, move_limit, heuristic);
+
             printf(
                 "iterations=%10d score=%10d moves=%5d pq_size=%5d nq_size=%5d "
-                "move_limit=%6d score/move=%5d\n",
-                iterations, board->score, board->moves,
-                (int)pq_size(pq), (int)pq_size(nq),
-                move_limit, board->score/(1 + board->moves) );
+                "move_limit=%6d score/move=%5d queue_cap=%7d mem=%5dMB "
+                "pruned=%4.1f%%\n",
+                iterations, batch[0]->score, batch[0]->moves,
+                (int)mq_size(pq), (int)mq_size(nq),
+                move_limit, batch[0]->score/(1 + batch[0]->moves),
+                (int)mq_capacity(pq), (int)(memory_used() >> 20),
+                generated > 0 ? 100.0*pruned/generated : 0.0 );
             next_update += 1000000; /* 1 sec */
         }
 
-        if (board->moves >= MOVE_LIMIT || board->score >= SCORE_LIMIT)
+        if (game_over)
         {
             printf("End of game reached!\n");
-            board_free(board);
+            for (n = 0; n < batch_size; ++n) board_free(batch[n]);
+            break;
+        }
+
+        long long children = 0, duplicates = 0;
+        #pragma omp parallel for schedule(dynamic, 1) \
+                                 reduction(+:children, duplicates)
+        for (n = 0; n < batch_size; ++n)
+        {
+            Expansion *exp =
+                &expansions[deterministic ? n : omp_get_thread_num()];
+            children += expand_board( batch[n], heuristic, threads,
+                                      &duplicates, exp );
+            board_free(batch[n]);
+            if (!deterministic) push_children(exp, pq, nq, move_limit);
+        }
+        if (deterministic)
+        {
+            /* The dead moves left in each thread's queue depend on thread
+               timing; free them all so memory use does not */
+            move_reclaim();
+            for (n = 0; n < batch_size; ++n)
+            {
+                push_children(&expansions[n], pq, nq, move_limit);
+            }
+        }
+        tuner.children += children;
+        generated += children + duplicates;
+        pruned += duplicates;
+    }
+
+    if (mq_empty(pq)) printf("Queue exhausted.\n");
+    wall_time = util_ustime() - wall_time;
+    printf( "%d iterations in %.3fs (%.0f iterations/sec)\n", iterations,
+            1e-6*wall_time, wall_time > 0 ? 1e6*iterations/wall_time : 0.0 );
+
+    /* Free queues */
+    free_board_queue(pq);
+    free_board_queue(nq);
+    move_reclaim_all();
+
+    free(batch);
+    free(expansions);
+    for (n = 0; n < num_threads; ++n)
+    {
+        board_free(threads[n].scratch);
+        board_free(threads[n].replica);
+    }
+    free(threads);
+}
+
+/* Run playouts on all threads until one reaches the move or score limit, or
+   time runs out. Returns the board at the end of the longest playout (with
+   trace information), or NULL if memory allocation failed. */
+static Board *run_playouts(Game *game, long long max_usec)
+{
+    long long time_start = ustime();
+    long long deadline = util_ustime() + max_usec;
+    long long playouts = 0;
+    volatile bool done = false;
+    PlayoutEngine *best = NULL;
+    Board *board;
+
+    #pragma omp parallel reduction(+:playouts)
+    {
+        unsigned seed = 12345U + 7919U*omp_get_thread_num();
+        PlayoutEngine *pe =
+            playout_create(game, candidates, num_candidates, seed);
+        assert(pe != NULL);
+
+        while (!done && util_ustime() < deadline)
+        {
+            playout_run(pe, PLAYOUT_RETRIES, deadline);
+            ++playouts;
+            if (pe->best_length >= MOVE_LIMIT || pe->best_score >= SCORE_LIMIT)
+            {
+                done = true;
+            }
+        }
+
+        /* Keep only the engine with the best playout, so that just one
+           trace needs to be replayed */
+        #pragma omp critical
+        {
+            if ( best == NULL || pe->best_length > best->best_length ||
+                 ( pe->best_length == best->best_length &&
+                   pe->best_score > best->best_score ) )
+            {
+                PlayoutEngine *tmp = best;
+                best = pe;
+                pe = tmp;
+            }
+        }
+        playout_destroy(pe);
+    }
+
+    printf( "%lld playouts in %.3fs\n", playouts,
+            1e-6*(ustime() - time_start) );
+
+    board = playout_best_board(best);
+    playout_destroy(best);
+    return board;
+}
+
+/* Replay a list of candidate indices from the initial board (with trace
+   information), or return NULL if memory allocation fails. */
+static Board *replay_candidates( Game *game, const unsigned short *trace,
+                                 int length )
+{
+    Board *board;
+    int n;
+
+    board = board_clone(game->initial);
+    if (board == NULL) return NULL;
+    for (n = 0; n < length; ++n)
+    {
+        const Candidate *cand = &candidates[trace[n]];
+        board_move( board, cand->r, cand->c,
+                    cand->r + cand->vert, cand->c + !cand->vert, 1 );
+    }
+
+    return board;
+}
+
+/* Store the valid moves of the current board in dt->order (after the first
+   dt->order_size entries), ordered by the heuristic value of the resulting
+   boards (best first), and return the number of valid moves. Children are
+   evaluated in place, using the undo log. If memory allocation fails,
+   dfs_done is set and fewer moves may be returned. */
+static int dfs_children(DfsThread *dt)
+{
+    int prio[MAX_MOVES], valid[MAX_MOVES];
+    Board *b = dt->board;
+    int *order;
+    int n, i, j, num_valid, count = 0;
+
+    num_valid = move_valid_candidates(b, candidates, num_candidates, valid);
+    if (dt->order_size + num_valid > dt->order_capacity)
+    {
+        size_t capacity = dt->order_capacity ? dt->order_capacity : MAX_MOVES;
+        while (capacity < dt->order_size + num_valid) capacity *= 2;
+        order = realloc(dt->order, capacity*sizeof(int));
+        if (order == NULL)
+        {
+            /* Out of memory: end the search */
+            dfs_done = true;
+            return 0;
+        }
+        dt->order = order;
+        dt->order_capacity = capacity;
+    }
+    order = dt->order + dt->order_size;
+    for (j = 0; j < num_valid; ++j)
+    {
+        const Candidate *cand = &candidates[n = valid[j]];
+        int p;
+
+        if ( board_move_logged( b, cand->r, cand->c,
+                                cand->r + cand->vert, cand->c + !cand->vert,
+                                0, dt->undo ) < 0 )
+        {
+            /* Out of memory: end the search */
+            dfs_done = true;
             break;
         }
+        p = heuristic1(b, cand);
+        board_undo(b, dt->undo);
 
-        int n;
-        #pragma omp parallel for
-        for (n = 0; n < num_candidates; ++n)
+        /* Insertion sort (number of valid moves is small) */
+        for (i = count; i > 0 && prio[i - 1] < p; --i)
         {
-            if (!move_valid_candidate(board, &candidates[n])) continue;
+            prio[i] = prio[i - 1];
+            order[i] = order[i - 1];
+        }
+        prio[i] = p;
+        order[i] = n;
+        ++count;
+    }
+
+    return count;
+}
+
+/* Record the current board if it is deeper than the best one so far. */
+static void dfs_update_best(DfsThread *dt)
+{
+    Board *b = dt->board;
+    if ( b->moves > dt->best_length ||
+         (b->moves == dt->best_length && b->score > dt->best_score) )
+    {
+        memcpy(dt->best_trace, dt->trace, b->moves*sizeof(unsigned short));
+        dt->best_length = b->moves;
+        dt->best_score  = b->score;
+    }
+}
+
+/* Explore the subtree below the current board depth-first, trying children in
+   heuristic order. Taking the i-th best child costs i discrepancies, and at
+   most `budget' discrepancies are spent along any path. The search ends when
+   a board reaches the move or score limit, at the deadline, or when the
+   undo log cannot be grown; in all cases dfs_done is set. Returns whether
+   any child was skipped because the budget was exhausted. On return, the
+   board is back in its original state unless dfs_done was set.
+
+   The ordered children of each node on the current path are kept on a stack
+   in dt->order, so they are computed only once per node, not each time the
+   search backtracks to it. */
+static bool dfs_explore(DfsThread *dt, int budget, long long deadline)
+{
+    Board *b = dt->board;
+    int base = b->moves, used = 0;
+    bool pruned = false;
+
+    dt->rank[base] = 0;
+    while (!dfs_done)
+    {
+        int d = b->moves, count, r;
+        const int *order;
+
+        if (b->moves >= MOVE_LIMIT || b->score >= SCORE_LIMIT)
+        {
+            dfs_update_best(dt);
+            dfs_done = true;
+            break;
+        }
+        if (++dt->nodes%1024 == 0 && ustime() >= deadline)
+        {
+            dfs_update_best(dt);
+            dfs_done = true;
+            break;
+        }
+
+        if (dt->rank[d] == 0)
+        {
+            /* First visit of this node: push its children */
+            dt->first[d] = dt->order_size;
+            dt->count[d] = dfs_children(dt);
+            dt->order_size += dt->count[d];
+            if (dt->count[d] == 0) dfs_update_best(dt);
+            if (dfs_done) break;
+        }
+        count = dt->count[d];
+        order = dt->order + dt->first[d];
+
+        r = dt->rank[d];
+        if (r < count && used + r > budget) pruned = true;
+        if (r >= count || used + r > budget)
+        {
+            /* Pop the children, backtrack to the parent and try its next
+               child */
+            dt->order_size = dt->first[d];
+            if (d == base) break;
+            board_undo(b, dt->undo);
+            used -= dt->rank[b->moves]++;
+            continue;
+        }
+
+        /* Descend into the r-th best child */
+        const Candidate *cand = &candidates[order[r]];
+        dt->trace[d] = (unsigned short)order[r];
+        if ( board_move_logged( b, cand->r, cand->c,
+                                cand->r + cand->vert, cand->c + !cand->vert,
+                                0, dt->undo ) < 0 )
+        {
+            /* Out of memory: end the search */
+            dfs_update_best(dt);
+            dfs_done = true;
+            break;
+        }
+        used += r;
+        dt->rank[d + 1] = 0;
+    }
+
+    return pruned;
+}
 
-            int  r = candidates[n].r;
-            int  c = candidates[n].c;
-            bool v = candidates[n].vert;
+/* Depth-first search for a feasible solution with limited discrepancy.
 
-            /* Build new board */
-            Board *new_board = board_clone(board);
-            assert(new_board != NULL);
-            board_move(new_board, r, c, r + v, c + !v, 1);
+   Children are ordered with the heuristic of the first search phase, and
+   the discrepancy budget is increased iteratively, so the first iteration
+   follows the heuristic greedily and later iterations deviate from it more
+   and more. All boards are explored in place (using undo logs), so memory use
+   is bounded by the maximum search depth. The children of the initial board
+   are distributed over the threads.
 
-            int prio = heuristic(new_board, &candidates[n]);
+   Returns the deepest board found (with trace information), or NULL if
+   memory allocation failed. */
+static Board *dfs_search(Game *game, long long max_usec)
+{
+    long long time_start = ustime();
+    long long deadline = time_start + max_usec;
+    long long nodes = 0;
+    int budget = 0, root_count;
+    bool pruned = true;
+    Board *best = NULL;
+    DfsThread root;
+
+    /* Order children of the initial board */
+    memset(&root, 0, sizeof(root));
+    root.board = board_clone(game->initial);
+    root.undo  = undo_create();
+    assert(root.board != NULL && root.undo != NULL);
+    root_count = dfs_children(&root);
+
+    dfs_done = false;
+    #pragma omp parallel reduction(+:nodes)
+    {
+        DfsThread dt;
+        memset(&dt, 0, sizeof(dt));
+        dt.board      = board_clone(game->initial);
+        dt.undo       = undo_create();
+        dt.first      = malloc((MOVE_LIMIT + 1)*sizeof(size_t));
+        dt.count      = malloc((MOVE_LIMIT + 1)*sizeof(int));
+        dt.rank       = malloc((MOVE_LIMIT + 1)*sizeof(unsigned short));
+        dt.trace      = malloc(MOVE_LIMIT*sizeof(unsigned short));
+        dt.best_trace = malloc(MOVE_LIMIT*sizeof(unsigned short));
+        dt.best_score = game->initial->score;
+        assert( dt.board != NULL && dt.undo != NULL && dt.first != NULL &&
+                dt.count != NULL && dt.rank != NULL && dt.trace != NULL &&
+                dt.best_trace != NULL );
+
+        /* Increase the discrepancy budget until the search space has been
+           exhausted (i.e. nothing was pruned in the last iteration) */
+        while (!dfs_done && pruned)
+        {
+            int n;
+
+            #pragma omp barrier
+            #pragma omp single
+            pruned = false;
 
-            Board *old_board = NULL;
-            if (new_board->moves < move_limit)
+            #pragma omp for schedule(dynamic, 1)
+            for (n = 0; n < root_count; ++n)
             {
-                /* Add to active queue */
-                #pragma omp critical
+                const Candidate *cand = &candidates[root.order[n]];
+
+                if (dfs_done) continue;
+                if (n > budget)
+                {
+                    /* Skipping a root child prunes it, like any other */
+                    pruned = true;
+                    continue;
+                }
+                board_copy(dt.board, game->initial);
+                undo_forget(dt.undo, 0);
+                dt.trace[0] = (unsigned short)root.order[n];
+                if ( board_move_logged( dt.board, cand->r, cand->c,
+                                        cand->r + cand->vert,
+                                        cand->c + !cand->vert, 0,
+                                        dt.undo ) < 0 )
                 {
-                    if (pq_full(pq)) old_board = pq_pop_min(pq);
-                    pq_push(pq, prio, new_board);
+                    dfs_done = true;    /* out of memory */
+                    continue;
                 }
+                if (dfs_explore(&dt, budget - n, deadline)) pruned = true;
             }
-            else
+
+            #pragma omp single
             {
-                /* Add to next queue */
-                #pragma omp critical
+                if (!dfs_done && pruned)
                 {
-                    if (pq_full(nq)) old_board = pq_pop_min(nq);
-                    pq_push(nq, prio, new_board);
+                    printf( "Discrepancy budget %d exhausted after %.3fs\n",
+                            budget, 1e-6*(ustime() - time_start) );
+                    ++budget;
                 }
             }
-            board_free(old_board);
         }
+        nodes += dt.nodes;
 
-        board_free(board);
+        #pragma omp critical
+        {
+            if ( best == NULL || dt.best_length > best->moves ||
+                 ( dt.best_length == best->moves &&
+                   dt.best_score > best->score ) )
+            {
+                board_free(best);
+                best = replay_candidates(game, dt.best_trace, dt.best_length);
+            }
+        }
+
+        board_free(dt.board);
+        undo_destroy(dt.undo);
+        free(dt.order);
+        free(dt.first);
+        free(dt.count);
+        free(dt.rank);
+        free(dt.trace);
+        free(dt.best_trace);
     }
 
-    if (pq_empty(pq)) printf("Queue exhausted.\n");
+    printf( "%lld nodes in %.3fs (%.0f nodes/sec)\n", nodes,
+            1e-6*(ustime() - time_start),
+            1e6*nodes/(ustime() - time_start + 1) );
 
-    /* Free queues */
-    while (!pq_empty(pq)) board_free(pq_pop_min(pq));
-    pq_destroy(pq);
-    while (!pq_empty(nq)) board_free(pq_pop_min(nq));
-    pq_destroy(nq);
+    board_free(root.board);
+    undo_destroy(root.undo);
+    free(root.order);
+
+    return best;
+}
+
+/* Write the best solution found to uitvoer.txt (and in the binary trace
+   format to `binary_trace_path', if set). */
+static void write_solution(const Game *game)
+{
+    FILE *fp = fopen("uitvoer.txt", "wt");
+    moves_print(best_move, fp);
+    fclose(fp);
+
+    if (binary_trace_path != NULL)
+    {
+        if ((fp = fopen(binary_trace_path, "wb")) == NULL)
+        {
+            perror("failed to write binary trace");
+            return;
+        }
+        moves_print_binary(game, best_move, fp);
+        fclose(fp);
+    }
+}
+
+static void usage()
+{
+    printf( "Usage: player [<options>] [<directory>]\n"
+            "Options:\n"
+            "  --time <seconds>      time limit (default: %d)\n"
+            "  --memory <megabytes>  memory budget (default: %d)\n"
+            "  --cache <directory>   solution cache directory\n"
+            "  --snapshot <file>     periodically save search state to file\n"
+            "  --snapshot-interval <seconds>\n"
+            "                        time between snapshots (default: %d)\n"
+            "  --resume <file>       resume search from a snapshot\n"
+            "  --binary-trace <file> also write the solution in binary "
+                                    "format\n"
+            "  --rollouts <count>    evaluate boards with rollouts "
+                                    "(default: 0)\n"
+            "  --rollout-depth <moves>\n"
+            "                        maximum rollout length (default: 20)\n"
+            "  --rollout-policy random|greedy\n"
+            "                        rollout move selection "
+                                    "(default: random)\n"
+            "  --dfs                 search for a feasible solution with "
+                                    "limited\n"
+            "                        discrepancy depth-first search\n"
+            "  --coordinator <socket>\n"
+            "                        exchange solutions between workers "
+                                    "(no search)\n"
+            "  --worker <socket>     exchange solutions with a coordinator\n"
+            "  --node <node>         run on the CPUs of the given NUMA node\n"
+            "  --pin                 pin threads to CPUs and allocate boards "
+                                    "per node\n"
+            "  --playout-time <seconds>\n"
+            "                        maximum time spent on playouts before "
+                                    "searching\n"
+            "                        (default: %d%% of time limit)\n"
+            "  --deterministic       expand boards in a reproducible order "
+                                    "(disables\n"
+            "                        playouts and depth-first search)\n"
+            "  --iterations <count>  stop after the given number of "
+                                    "iterations instead\n"
+            "                        of at the time limit (combine with "
+                                    "--deterministic\n"
+            "                        for reproducible results)\n"
+            "  --board-moves <count> stop after the given number of "
+                                    "moves performed\n"
+            "                        (including rollouts) instead of at "
+                                    "the time limit\n",
+            DEFAULT_TIME_LIMIT, DEFAULT_MEMORY_LIMIT,
+            DEFAULT_SNAPSHOT_INTERVAL, (int)(100*DEFAULT_PLAYOUT_FRACTION) );
 }
 
 int main(int argc, char *argv[])
 {
     long long time_start = ustime();
-    long long time_limit = 1000000LL*(15*60 - 5); /* 14 minutes, 55 seconds */
+    long long time_limit = 1000000LL*DEFAULT_TIME_LIMIT;
+    wall_start = util_ustime();
+    memory_limit = (long long)DEFAULT_MEMORY_LIMIT << 20;
+    snapshot_interval = 1000000LL*DEFAULT_SNAPSHOT_INTERVAL;
+    long long playout_time = -1;
+    bool use_dfs = false;
+    const char *dir = ".", *cache_dir = NULL, *resume_path = NULL;
+    const char *coordinator_path = NULL, *worker_path = NULL;
+    int node = -1;
+    Board *cached = NULL, *played = NULL, *found = NULL, *seed;
+    bool feasible = false;  /* whether a solution reached the move limit */
+    SearchState resumed, *resume = NULL;
+    int n;
 
     mem_debug_report_at_exit(stderr);
 
-    if (argc > 2)
+    /* Parse command line arguments */
+    for (n = 1; n < argc; ++n)
     {
-        printf("Usage: player [<directory>]\n");
-        return 0;
+        if (strcmp(argv[n], "--time") == 0 && n + 1 < argc)
+        {
+            time_limit = (long long)(1e6*atof(argv[++n]));
+        }
+        else
+        if (strcmp(argv[n], "--memory") == 0 && n + 1 < argc)
+        {
+            memory_limit = (long long)(1048576.0*atof(argv[++n]));
+        }
+        else
+        if (strcmp(argv[n], "--cache") == 0 && n + 1 < argc)
+        {
+            cache_dir = argv[++n];
+        }
+        else
+        if (strcmp(argv[n], "--snapshot") == 0 && n + 1 < argc)
+        {
+            snapshot_path = argv[++n];
+        }
+        else
+        if (strcmp(argv[n], "--snapshot-interval") == 0 && n + 1 < argc)
+        {
+            snapshot_interval = (long long)(1e6*atof(argv[++n]));
+        }
+        else
+        if (strcmp(argv[n], "--resume") == 0 && n + 1 < argc)
+        {
+            resume_path = argv[++n];
+        }
+        else
+        if (strcmp(argv[n], "--binary-trace") == 0 && n + 1 < argc)
+        {
+            binary_trace_path = argv[++n];
+        }
+        else
+        if (strcmp(argv[n], "--rollouts") == 0 && n + 1 < argc)
+        {
+            rollout_count = atoi(argv[++n]);
+        }
+        else
+        if (strcmp(argv[n], "--rollout-depth") == 0 && n + 1 < argc)
+        {
+            rollout_depth = atoi(argv[++n]);
+        }
+        else
+        if (strcmp(argv[n], "--rollout-policy") == 0 && n + 1 < argc)
+        {
+            ++n;
+            if (strcmp(argv[n], "random") == 0)
+            {
+                rollout_policy = ROLLOUT_RANDOM;
+            }
+            else
+            if (strcmp(argv[n], "greedy") == 0)
+            {
+                rollout_policy = ROLLOUT_GREEDY;
+            }
+            else
+            {
+                usage();
+                return 0;
+            }
+        }
+        else
+        if (strcmp(argv[n], "--coordinator") == 0 && n + 1 < argc)
+        {
+            coordinator_path = argv[++n];
+        }
+        else
+        if (strcmp(argv[n], "--worker") == 0 && n + 1 < argc)
+        {
+            worker_path = argv[++n];
+        }
+        else
+        if (strcmp(argv[n], "--node") == 0 && n + 1 < argc)
+        {
+            node = atoi(argv[++n]);
+        }
+        else
+        if (strcmp(argv[n], "--pin") == 0)
+        {
+            pin_threads = true;
+        }
+        else
+        if (strcmp(argv[n], "--dfs") == 0)
+        {
+            use_dfs = true;
+        }
+        else
+        if (strcmp(argv[n], "--playout-time") == 0 && n + 1 < argc)
+        {
+            playout_time = (long long)(1e6*atof(argv[++n]));
+        }
+        else
+        if (strcmp(argv[n], "--deterministic") == 0)
+        {
+            deterministic = true;
+        }
+        else
+        if (strcmp(argv[n], "--iterations") == 0 && n + 1 < argc)
+        {
+            iteration_budget = (long long)atof(argv[++n]);
+        }
+        else
+        if (strcmp(argv[n], "--board-moves") == 0 && n + 1 < argc)
+        {
+            move_budget = (long long)atof(argv[++n]);
+        }
+        else
+        if (argv[n][0] != '-' && n + 1 == argc)
+        {
+            dir = argv[n];
+        }
+        else
+        {
+            usage();
+            return 0;
+        }
     }
 
-    Game *game = game_load(argc < 2 ? "." : argv[1]);
+    if (deterministic && worker_path != NULL)
+    {
+        fprintf(stderr, "--deterministic cannot be used with --worker\n");
+        exit(1);
+    }
+    if (deterministic || iteration_budget > 0 || move_budget > 0)
+    {
+        /* Playouts and depth-first search depend on thread timing, and are
+           bounded by wall-clock time only */
+        playout_time = 0;
+        use_dfs = false;
+    }
+    if (iteration_budget > 0 || move_budget > 0)
+    {
+        /* Switch to the virtual clock */
+        virtual_time_limit = time_limit;
+        time_start = ustime();
+    }
+
+    Game *game = game_load(dir);
     if (game == NULL)
     {
         perror("failed to load board definition");
         exit(1);
     }
 
+    if (coordinator_path != NULL)
+    {
+        /* Only exchange solutions between workers */
+        long long max_usec = time_limit + 1000000LL*COORDINATOR_GRACE;
+        Board *board = exchange_serve(coordinator_path, game, max_usec);
+        if (board != NULL)
+        {
+            best_score = board->score;
+            best_move  = move_ref(board->last_move);
+            board_free(board);
+        }
+        printf("Best score: %d\n", best_score);
+        write_solution(game);
+        game_free(game);
+        move_deref(best_move);
+        move_reclaim_all();
+        return 0;
+    }
+
+    if (node >= 0)
+    {
+        int cpus = numa_bind_process(node);
+        if (cpus == 0)
+        {
+            fprintf(stderr, "failed to bind to NUMA node %d\n", node);
+        }
+        else
+        if (getenv("OMP_NUM_THREADS") == NULL)
+        {
+            omp_set_num_threads(cpus);
+        }
+    }
+
+    if (pin_threads)
+    {
+        /* Pin threads, and let them allocate boards on their own node */
+        board_pool_init(numa_num_nodes());
+        #pragma omp parallel
+        board_pool_set_node(numa_pin_thread(omp_get_thread_num()));
+    }
+
+    if (worker_path != NULL)
+    {
+        exchange = exchange_connect(worker_path, game);
+        if (exchange == NULL) perror("failed to connect to coordinator");
+    }
+
     printf("Using %d threads\n", omp_get_max_threads());
+    if (game->num_regions > 1)
+    {
+        printf("Board has %d independent regions:", game->num_regions);
+        for (n = 0; n < game->num_regions; ++n)
+        {
+            printf( " %d-%d", game->regions[n].c1,
+                    game->regions[n].c2 - 1 );
+        }
+        printf("\n");
+    }
 
     /* Generate candidate moves */
     num_candidates = move_generate_candidates(game->initial, candidates);
 
-    /* First, search for a single feasible solution */
-    search(game, time_limit, false, heuristic1, 10000);
+    /* Seed the search with the best known solution from the cache */
+    if (cache_dir != NULL && (cached = cache_load(cache_dir, game)) != NULL)
+    {
+        printf( "Cached solution: score=%d moves=%d\n",
+                cached->score, cached->moves );
+        best_score = cached->score;
+        best_move  = move_ref(cached->last_move);
+    }
 
-    /* Search for maximum scoring solution */
-    long long time_left = time_start + time_limit - ustime();
-    if (time_left > 0) search(game, time_left, true, heuristic2, 1000);
+    /* Restore search state from a snapshot */
+    if (resume_path != NULL)
+    {
+        if (!snapshot_load(resume_path, game, &resumed, QUEUE_CAP_MIN))
+        {
+            fprintf(stderr, "failed to resume from %s\n", resume_path);
+            if (exchange != NULL) exchange_close(exchange);
+            board_free(cached);
+            board_pool_destroy();
+            game_free(game);
+            move_deref(best_move);
+            move_reclaim_all();
+            exit(1);
+        }
+        printf( "Resuming phase %d with %d+%d boards (best score: %d)\n",
+                resumed.phase + 1, (int)pq_size(resumed.pq),
+                (int)pq_size(resumed.nq), resumed.best_score );
+        if (resumed.best_score > best_score)
+        {
+            best_score = resumed.best_score;
+            move_deref(best_move);
+            best_move = move_ref(resumed.best_move);
+        }
+        move_deref(resumed.best_move);
+        resume = &resumed;
+        if (snapshot_path == NULL) snapshot_path = resume_path;
+    }
 
-    game_free(game);
+    signal(SIGTERM, handle_sigterm);
+
+    if ( cached != NULL &&
+         (cached->moves >= MOVE_LIMIT || cached->score >= SCORE_LIMIT) )
+    {
+        printf("Cached solution cannot be improved.\n");
+    }
+    else
+    {
+        /* Look for a feasible solution quickly with playouts, which then
+           serves as a baseline for the search. A solution that reaches the
+           move limit cannot be extended, so it only sets the best score;
+           otherwise the longest solution found seeds the search. */
+        seed = cached;
+        if (playout_time < 0)
+        {
+            playout_time = DEFAULT_PLAYOUT_FRACTION*time_limit;
+        }
+        if (resume == NULL && playout_time > 0)
+        {
+            played = run_playouts(game, playout_time);
+            if (played != NULL)
+            {
+                printf( "Playout solution: score=%d moves=%d\n",
+                        played->score, played->moves );
+                if (played->score > best_score)
+                {
+                    best_score = played->score;
+                    move_deref(best_move);
+                    best_move = move_ref(played->last_move);
+                }
+                if (played->moves >= MOVE_LIMIT) feasible = true;
+                else
+                if (seed == NULL || played->moves > seed->moves) seed = played;
+            }
+        }
+
+        /* First, search for a single feasible solution (queue capacities
+           given here are initial values only; the tuner adjusts them) */
+        if (use_dfs && resume == NULL && !feasible)
+        {
+            long long time_left = time_start + time_limit - ustime();
+            found = dfs_search(game, DFS_TIME_FRACTION*time_left);
+            if (found != NULL)
+            {
+                printf( "Depth-first solution: score=%d moves=%d\n",
+                        found->score, found->moves );
+                if (found->score > best_score)
+                {
+                    best_score = found->score;
+                    move_deref(best_move);
+                    best_move = move_ref(found->last_move);
+                }
+                if (found->moves >= MOVE_LIMIT) feasible = true;
+                else
+                if (seed == NULL || found->moves > seed->moves) seed = found;
+            }
+        }
+        else
+        if ((resume == NULL || resume->phase == 0) && !feasible)
+        {
+            long long time_left = time_start + time_limit - ustime();
+            search(game, time_left, false, heuristic1, 10000, seed, resume);
+            resume = NULL;
+        }
+
+        /* Search for maximum scoring solution */
+        long long time_left = time_start + time_limit - ustime();
+        if ( time_left > 0 && !terminate_requested &&
+             best_score < SCORE_LIMIT )
+        {
+            search(game, time_left, true, heuristic2, 1000, seed, resume);
+            resume = NULL;
+        }
+
+        /* Write back improved solution */
+        if ( cache_dir != NULL && best_score > 0 &&
+             (cached == NULL || best_score > cached->score) &&
+             cache_store(cache_dir, game, best_move, best_score) )
+        {
+            printf("Stored solution in cache.\n");
+        }
+    }
+
+    /* Release restored search state if it was not used */
+    if (resume != NULL)
+    {
+        while (!pq_empty(resume->pq)) board_free(pq_pop_min(resume->pq));
+        pq_destroy(resume->pq);
+        while (!pq_empty(resume->nq)) board_free(pq_pop_min(resume->nq));
+        pq_destroy(resume->nq);
+    }
+
+    board_free(found);
+    board_free(played);
+    board_free(cached);
+    board_pool_destroy();
+
+    if (exchange != NULL)
+    {
+        exchange_send(exchange, best_score, best_move);
+        exchange_close(exchange);
+    }
+
+    /* Report total throughput of the search */
+    long long elapsed = util_ustime() - wall_start;
+    if (iterations_done > 0 && elapsed > 0)
+    {
+        printf( "Searched %lld nodes with %lld board moves in %.3fs "
+                "(%.0f nodes/sec, %.0f moves/sec)\n", iterations_done,
+                (long long)board_move_count(), 1e-6*elapsed,
+                1e6*iterations_done/elapsed,
+                1e6*board_move_count()/elapsed );
+    }
 
     /* Write best score trace */
     printf("Best score: %d\n", best_score);
-    FILE *fp = fopen("uitvoer.txt", "wt");
-    moves_print(best_move, fp);
-    fclose(fp);
+    write_solution(game);
+    game_free(game);
 
     move_deref(best_move);
+    move_reclaim_all();
 
     return 0;
 }
@@ -0,0 +1,90 @@
+/* Converts move traces between the text format (as written to uitvoer.txt)
+   and the compact binary trace format (see Game.h).
+
+   Usage: traceconv <directory> [<input> [<output>]]
+
+   The input format is detected automatically, and the output is written in
+   the other format. Input and output default to standard input and output.
+   The trace is replayed on the game in the given directory while it is
+   read, so invalid traces are rejected.
+*/
+
+#include "Game.h"
+#include "MemDebug.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char *argv[])
+{
+    FILE *in = stdin, *out = stdout;
+    Game *game;
+    Board *board;
+    int c, binary, moves;
+
+    mem_debug_report_at_exit(stderr);
+
+    if (argc < 2 || argc > 4)
+    {
+        printf("Usage: traceconv <directory> [<input> [<output>]]\n");
+        return 1;
+    }
+
+    game = game_load(argv[1]);
+    if (game == NULL)
+    {
+        perror("failed to load board definition");
+        return 1;
+    }
+
+    if (argc > 2 && (in = fopen(argv[2], "rb")) == NULL)
+    {
+        perror("failed to open input");
+        game_free(game);
+        return 1;
+    }
+
+    /* Peek at the input to determine its format */
+    c = getc(in);
+    binary = (c == TRACE_MAGIC[0]);
+    if (c != EOF) ungetc(c, in);
+
+    board = board_clone(game->initial);
+    moves = moves_replay(board, in);
+    if (in != stdin) fclose(in);
+    if (moves < 0)
+    {
+        fprintf(stderr, "invalid trace\n");
+        board_free(board);
+        game_free(game);
+        return 1;
+    }
+
+    if (argc > 3 && (out = fopen(argv[3], binary ? "wt" : "wb")) == NULL)
+    {
+        perror("failed to open output");
+        board_free(board);
+        game_free(game);
+        return 1;
+    }
+    if (binary)
+    {
+        moves_print(board->last_move, out);
+    }
+    else
+    {
+        moves_print_binary(game, board->last_move, out);
+    }
+    if (out != stdout && fclose(out) != 0)
+    {
+        perror("failed to write output");
+    }
+
+    fprintf( stderr, "%d moves converted to %s format\n",
+             moves, binary ? "text" : "binary" );
+
+    board_free(board);
+    move_reclaim_all();
+    game_free(game);
+
+    return 0;
+}
@@ -2,13 +2,14 @@
 #include "MemDebug.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 int main(int argc, char *argv[])
 {
     Game *game;
     Board *board;
-    int moves;
+    int moves, c, binary = 0;
 
     mem_debug_report_at_exit(stderr);
 
@@ -26,44 +27,83 @@ int main(int argc, char *argv[])
     }
     board = board_clone(game->initial);
 
+    /* Detect the binary trace format */
+    c = getc(stdin);
+    if (c == TRACE_MAGIC[0])
+    {
+        char magic[sizeof(TRACE_MAGIC) - 2];
+        if ( fread(magic, 1, sizeof(magic), stdin) != sizeof(magic) ||
+             memcmp(magic, TRACE_MAGIC + 1, sizeof(magic)) != 0 )
+        {
+            printf("Invalid binary trace header.\n");
+            board_free(board);
+            game_free(game);
+            return 1;
+        }
+        binary = 1;
+    }
+    else
+    if (c != EOF)
+    {
+        ungetc(c, stdin);
+    }
+
     for (moves = 0; moves < MOVE_LIMIT; ++moves)
     {
         int x1, y1, x2, y2;
         char dir;
 
-        if (scanf("%d %d %ch", &x1, &y1, &dir) != 3)
+        if (!binary)
         {
-            printf("EOF reached.\n");
-            break;
-        }
+            if (scanf("%d %d %ch", &x1, &y1, &dir) != 3)
+            {
+                printf("EOF reached.\n");
+                break;
+            }
 
-        if (dir == 'N')
-        {
-            x2 = x1;
-            y2 = y1 - 1;
+            if (dir == 'N')
+            {
+                x2 = x1;
+                y2 = y1 - 1;
+            }
+            else
+            if (dir == 'O')
+            {
+                x2 = x1 + 1;
+                y2 = y1;
+            }
+            else
+            if (dir == 'Z')
+            {
+                x2 = x1;
+                y2 = y1 + 1;
+            }
+            else
+            if (dir == 'W')
+            {
+                x2 = x1 - 1;
+                y2 = y1;
+            }
+            else
+            {
+                printf("Invalid direction (%c).\n", dir);
+                break;
+            }
         }
         else
-        if (dir == 'O')
         {
-            x2 = x1 + 1;
-            y2 = y1;
-        }
-        else
-        if (dir == 'Z')
-        {
-            x2 = x1;
-            y2 = y1 + 1;
-        }
-        else
-        if (dir == 'W')
-        {
-            x2 = x1 - 1;
-            y2 = y1;
-        }
-        else
-        {
-            printf("Invalid direction (%c).\n", dir);
-            break;
+            int res = move_read_binary(stdin, game, &y1, &x1, &y2, &x2);
+            if (res == 0)
+            {
+                printf("EOF reached.\n");
+                break;
+            }
+            if (res < 0)
+            {
+                printf("Malformed binary trace.\n");
+                break;
+            }
+            dir = (y2 > y1) ? 'Z' : 'O';
         }
 
         if ( x1 < 0 || x1 >= game->width || y1 < 0 || y1 >= game->height )